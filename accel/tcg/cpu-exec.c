@@ -243,6 +243,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
 
     hash = tb_jmp_cache_hash_func(pc);
     jc = cpu->tb_jmp_cache;
+    qatomic_set(&jc->stats.lookups, jc->stats.lookups + 1);
 
     tb = qatomic_read(&jc->array[hash].tb);
     if (likely(tb &&
@@ -253,6 +254,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
         goto hit;
     }
 
+    qatomic_set(&jc->stats.jc_misses, jc->stats.jc_misses + 1);
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return NULL;
@@ -630,7 +632,8 @@ void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr)
     tb_target_set_jmp_target(c_tb, n, jmp_rx, jmp_rw);
 }
 
-static inline void tb_add_jump(TranslationBlock *tb, int n,
+/* Return true if the jump was chained, false if it was left alone. */
+static inline bool tb_add_jump(TranslationBlock *tb, int n,
                                TranslationBlock *tb_next)
 {
     uintptr_t old;
@@ -661,11 +664,11 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
 
     qemu_log_mask(CPU_LOG_EXEC, "Linking TBs %p index %d -> %p\n",
                   tb->tc.ptr, n, tb_next->tc.ptr);
-    return;
+    return true;
 
  out_unlock_next:
     qemu_spin_unlock(&tb_next->jmp_lock);
-    return;
+    return false;
 }
 
 static inline bool cpu_handle_halt(CPUState *cpu)
@@ -898,8 +901,11 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
                                     vaddr pc, TranslationBlock **last_tb,
                                     int *tb_exit)
 {
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+
     trace_exec_tb(tb, pc);
     tb = cpu_tb_exec(cpu, tb, tb_exit);
+    qatomic_set(&jc->stats.exits, jc->stats.exits + 1);
     if (*tb_exit != TB_EXIT_REQUESTED) {
         *last_tb = tb;
         return;
@@ -959,6 +965,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             uint32_t flags, cflags;
 
             cpu_get_tb_cpu_state(cpu_env(cpu), &pc, &cs_base, &flags);
+            qemu_plugin_vcpu_sample(cpu, pc);
 
             /*
              * When requested, use an exact setting for cflags for the next
@@ -995,6 +1002,8 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                 jc = cpu->tb_jmp_cache;
                 jc->array[h].pc = pc;
                 qatomic_set(&jc->array[h].tb, tb);
+                qatomic_set(&jc->stats.translations,
+                            jc->stats.translations + 1);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1009,8 +1018,10 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             }
 #endif
             /* See if we can patch the calling TB. */
-            if (last_tb) {
-                tb_add_jump(last_tb, tb_exit, tb);
+            if (last_tb && tb_add_jump(last_tb, tb_exit, tb)) {
+                CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+                qatomic_set(&jc->stats.chains, jc->stats.chains + 1);
             }
 
             cpu_loop_exec_tb(cpu, tb, pc, &last_tb, &tb_exit);
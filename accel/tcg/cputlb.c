@@ -136,6 +136,16 @@ static inline CPUTLBEntry *tlb_entry(CPUState *cpu, uintptr_t mmu_idx,
     return &cpu->neg.tlb.f[mmu_idx].table[tlb_index(cpu, mmu_idx, addr)];
 }
 
+/* Find the first victim TLB index of the set for the mmu_idx + page pair. */
+static inline size_t vtlb_set_index(CPUState *cpu, uintptr_t mmu_idx,
+                                    vaddr page)
+{
+    unsigned bits = ctz64(tlb_n_entries(&cpu->neg.tlb.f[mmu_idx]));
+    size_t set = (page >> (TARGET_PAGE_BITS + bits)) & (CPU_VTLB_SETS - 1);
+
+    return set * CPU_VTLB_WAYS;
+}
+
 static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
                              size_t max_entries)
 {
@@ -278,7 +288,7 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    memset(desc->vindex, 0, sizeof(desc->vindex));
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -344,25 +354,6 @@ void tlb_destroy(CPUState *cpu)
     }
 }
 
-/* flush_all_helper: run fn across all cpus
- *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
- */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
-{
-    CPUState *cpu;
-
-    CPU_FOREACH(cpu) {
-        if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
-        }
-    }
-}
-
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     uint16_t asked = data.host_int;
@@ -417,21 +408,6 @@ void tlb_flush(CPUState *cpu)
     tlb_flush_by_mmuidx(cpu, ALL_MMUIDX_BITS);
 }
 
-void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
-{
-    const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
-
-    tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
-
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-}
-
-void tlb_flush_all_cpus_synced(CPUState *src_cpu)
-{
-    tlb_flush_by_mmuidx_all_cpus_synced(src_cpu, ALL_MMUIDX_BITS);
-}
-
 static bool tlb_hit_page_mask_anyprot(CPUTLBEntry *tlb_entry,
                                       vaddr page, vaddr mask)
 {
@@ -457,6 +433,23 @@ static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
     return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
 }
 
+/**
+ * tlb_entry_page - return the page mapped by an entry in use
+ * @te: pointer to CPUTLBEntry
+ */
+static vaddr tlb_entry_page(const CPUTLBEntry *te)
+{
+    uint64_t addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = tlb_addr_write(te);
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
 /* Called with tlb_c.lock held */
 static bool tlb_flush_entry_mask_locked(CPUTLBEntry *tlb_entry,
                                         vaddr page,
@@ -480,10 +473,15 @@ static void tlb_flush_vtlb_page_mask_locked(CPUState *cpu, int mmu_idx,
                                             vaddr mask)
 {
     CPUTLBDesc *d = &cpu->neg.tlb.d[mmu_idx];
-    int k;
+    int k = 0, n = CPU_VTLB_SIZE;
 
     assert_cpu_is_self(cpu);
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+    /* A single page can only be in its own set. */
+    if (mask == -1) {
+        k = vtlb_set_index(cpu, mmu_idx, page);
+        n = k + CPU_VTLB_WAYS;
+    }
+    for (; k < n; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(cpu, mmu_idx);
         }
@@ -496,6 +494,59 @@ static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
 }
 
+/*
+ * Largest tlb, in entries, that tlb_flush_page_large_locked() scans.
+ * Above that, a full flush of the mmu_idx is cheaper than the scan,
+ * which would be repeated on every page flush as long as an entry
+ * filled from a large page survives, e.g. for a guest's direct map.
+ */
+#define TLB_LARGE_FLUSH_SCAN_MAX (1 << CPU_TLB_DYN_DEFAULT_BITS)
+
+/*
+ * Flush the entry for @page along with any entry filled from a large
+ * page containing @page.  Each entry records the size of the page it
+ * was filled from, so rather than flushing the whole tlb we scan it and
+ * keep the entries which are unrelated to @page.
+ */
+static void tlb_flush_page_large_locked(CPUState *cpu, int midx, vaddr page)
+{
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    CPUTLBDescFast *f = &cpu->neg.tlb.f[midx];
+    size_t i, n = tlb_n_entries(f);
+    bool any_large = false;
+
+    for (i = 0; i < n + CPU_VTLB_SIZE; i++) {
+        CPUTLBEntry *te;
+        CPUTLBEntryFull *full;
+        vaddr mask = -1;
+
+        if (i < n) {
+            te = &f->table[i];
+            full = &d->fulltlb[i];
+        } else {
+            te = &d->vtable[i - n];
+            full = &d->vfulltlb[i - n];
+        }
+        if (tlb_entry_is_empty(te)) {
+            continue;
+        }
+        if (full->lg_page_size > TARGET_PAGE_BITS) {
+            mask = -((vaddr)1 << full->lg_page_size);
+        }
+        if (tlb_flush_entry_mask_locked(te, page, mask)) {
+            tlb_n_used_entries_dec(cpu, midx);
+        } else if (mask != -1) {
+            any_large = true;
+        }
+    }
+
+    /* If that was the last large page, stop scanning on every flush. */
+    if (!any_large) {
+        d->large_page_addr = -1;
+        d->large_page_mask = -1;
+    }
+}
+
 static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 {
     vaddr lp_addr = cpu->neg.tlb.d[midx].large_page_addr;
@@ -503,10 +554,17 @@ static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d (%016"
-                  VADDR_PRIx "/%016" VADDR_PRIx ")\n",
-                  midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+        if (tlb_n_entries(&cpu->neg.tlb.f[midx]) > TLB_LARGE_FLUSH_SCAN_MAX) {
+            tlb_debug("forcing full flush midx %d (%016"
+                      VADDR_PRIx "/%016" VADDR_PRIx ")\n",
+                      midx, lp_addr, lp_mask);
+            tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+        } else {
+            tlb_debug("flushing large pages midx %d (%016"
+                      VADDR_PRIx "/%016" VADDR_PRIx ")\n",
+                      midx, lp_addr, lp_mask);
+            tlb_flush_page_large_locked(cpu, midx, page);
+        }
     } else {
         if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
             tlb_n_used_entries_dec(cpu, midx);
@@ -550,50 +608,6 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
     tb_jmp_cache_clear_page(cpu, addr);
 }
 
-/**
- * tlb_flush_page_by_mmuidx_async_1:
- * @cpu: cpu on which to flush
- * @data: encoded addr + idxmap
- *
- * Helper for tlb_flush_page_by_mmuidx and friends, called through
- * async_run_on_cpu.  The idxmap parameter is encoded in the page
- * offset of the target_ptr field.  This limits the set of mmu_idx
- * that can be passed via this method.
- */
-static void tlb_flush_page_by_mmuidx_async_1(CPUState *cpu,
-                                             run_on_cpu_data data)
-{
-    vaddr addr_and_idxmap = data.target_ptr;
-    vaddr addr = addr_and_idxmap & TARGET_PAGE_MASK;
-    uint16_t idxmap = addr_and_idxmap & ~TARGET_PAGE_MASK;
-
-    tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-}
-
-typedef struct {
-    vaddr addr;
-    uint16_t idxmap;
-} TLBFlushPageByMMUIdxData;
-
-/**
- * tlb_flush_page_by_mmuidx_async_2:
- * @cpu: cpu on which to flush
- * @data: allocated addr + idxmap
- *
- * Helper for tlb_flush_page_by_mmuidx and friends, called through
- * async_run_on_cpu.  The addr+idxmap parameters are stored in a
- * TLBFlushPageByMMUIdxData structure that has been allocated
- * specifically for this helper.  Free the structure when done.
- */
-static void tlb_flush_page_by_mmuidx_async_2(CPUState *cpu,
-                                             run_on_cpu_data data)
-{
-    TLBFlushPageByMMUIdxData *d = data.host_ptr;
-
-    tlb_flush_page_by_mmuidx_async_0(cpu, d->addr, d->idxmap);
-    g_free(d);
-}
-
 void tlb_flush_page_by_mmuidx(CPUState *cpu, vaddr addr, uint16_t idxmap)
 {
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%" PRIx16 "\n", addr, idxmap);
@@ -611,47 +625,6 @@ void tlb_flush_page(CPUState *cpu, vaddr addr)
     tlb_flush_page_by_mmuidx(cpu, addr, ALL_MMUIDX_BITS);
 }
 
-void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
-                                              vaddr addr,
-                                              uint16_t idxmap)
-{
-    tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
-
-    /* This should already be page aligned */
-    addr &= TARGET_PAGE_MASK;
-
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                              RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
-                              RUN_ON_CPU_HOST_PTR(d));
-    }
-}
-
 void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr)
 {
     tlb_flush_page_by_mmuidx_all_cpus_synced(src, addr, ALL_MMUIDX_BITS);
@@ -752,12 +725,155 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
     }
 }
 
-static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
-                                              run_on_cpu_data data)
+/*
+ * Flushes requested of other cpus, by tlb_flush_*_all_cpus_synced, are
+ * queued in the destination's CPUTLBCommon and performed by a single
+ * work item.  Requests which arrive while that work item is pending are
+ * merged into it, so that a burst of requests, e.g. a guest issuing a
+ * TLB invalidate per page while unmapping a region, costs each cpu a
+ * single exit and the requesting cpu a single exclusive section.
+ */
+#define TLB_PENDING_ASYNC  1
+#define TLB_PENDING_SAFE   2
+
+static void tlb_flush_pending_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_SIZE];
+    uint16_t full;
+    unsigned i, n;
+
+    assert_cpu_is_self(cpu);
+
+    qemu_spin_lock(&c->lock);
+    full = c->pending_idxmap;
+    n = c->pending_n;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    c->pending_idxmap = 0;
+    c->pending_n = 0;
+    c->pending_work &= ~data.host_int;
+    qemu_spin_unlock(&c->lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        TLBFlushRangeData d = {
+            .addr = pending[i].addr,
+            .len = pending[i].len,
+            .idxmap = pending[i].idxmap & ~full,
+            .bits = pending[i].bits,
+        };
+
+        if (d.idxmap == 0) {
+            continue;
+        }
+        if (d.bits >= TARGET_LONG_BITS && d.len <= TARGET_PAGE_SIZE) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, d.addr, d.idxmap);
+        } else {
+            tlb_flush_range_by_mmuidx_async_0(cpu, d);
+        }
+    }
+}
+
+/*
+ * Queue a flush of the mmu_idx in @full, and of the range @d if not NULL,
+ * on @cpu.  With @safe, the flush is performed as "safe" work, exiting
+ * the loop and creating a synchronisation point where all queued work
+ * will be finished before execution starts again.
+ */
+static void tlb_flush_queue(CPUState *cpu, uint16_t full,
+                            const TLBFlushRangeData *d, bool safe)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    unsigned kind = safe ? TLB_PENDING_SAFE : TLB_PENDING_ASYNC;
+    bool queue;
+
+    qemu_spin_lock(&c->lock);
+    if (d) {
+        uint16_t idxmap = d->idxmap & ~(c->pending_idxmap | full);
+
+        if (idxmap == 0) {
+            /* Already covered by a pending full flush. */
+        } else if (c->pending_n < CPU_TLB_PENDING_SIZE) {
+            c->pending[c->pending_n++] = (CPUTLBPendingFlush) {
+                .addr = d->addr,
+                .len = d->len,
+                .idxmap = idxmap,
+                .bits = d->bits,
+            };
+        } else {
+            /* Too many to track individually. */
+            full |= idxmap;
+        }
+    }
+    c->pending_idxmap |= full;
+
+    /* Any pending work item will do, unless a synchronisation is needed. */
+    if (safe) {
+        queue = !(c->pending_work & TLB_PENDING_SAFE);
+    } else {
+        queue = !c->pending_work;
+    }
+    if (queue) {
+        c->pending_work |= kind;
+    } else {
+        qatomic_set(&c->batch_flush_count, c->batch_flush_count + 1);
+    }
+    qemu_spin_unlock(&c->lock);
+
+    if (!queue) {
+        return;
+    }
+    if (safe) {
+        async_safe_run_on_cpu(cpu, tlb_flush_pending_work,
+                              RUN_ON_CPU_HOST_INT(kind));
+    } else {
+        async_run_on_cpu(cpu, tlb_flush_pending_work,
+                         RUN_ON_CPU_HOST_INT(kind));
+    }
+}
+
+static void tlb_flush_queue_all_cpus_synced(CPUState *src_cpu, uint16_t full,
+                                            const TLBFlushRangeData *d)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_queue(cpu, full, d, false);
+        }
+    }
+    tlb_flush_queue(src_cpu, full, d, true);
+}
+
+void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
+{
+    tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
+
+    tlb_flush_queue_all_cpus_synced(src_cpu, idxmap, NULL);
+}
+
+void tlb_flush_all_cpus_synced(CPUState *src_cpu)
+{
+    tlb_flush_by_mmuidx_all_cpus_synced(src_cpu, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                              vaddr addr,
+                                              uint16_t idxmap)
 {
-    TLBFlushRangeData *d = data.host_ptr;
-    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
-    g_free(d);
+    TLBFlushRangeData d;
+
+    tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
+
+    /* This should already be page aligned */
+    d.addr = addr & TARGET_PAGE_MASK;
+    d.len = TARGET_PAGE_SIZE;
+    d.idxmap = idxmap;
+    d.bits = TARGET_LONG_BITS;
+
+    tlb_flush_queue_all_cpus_synced(src_cpu, 0, &d);
 }
 
 void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
@@ -803,8 +919,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                uint16_t idxmap,
                                                unsigned bits)
 {
-    TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
+    TLBFlushRangeData d;
 
     /*
      * If all bits are significant, and len is small,
@@ -826,18 +941,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
-    p = g_memdup(&d, sizeof(d));
-    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
-                          RUN_ON_CPU_HOST_PTR(p));
+    tlb_flush_queue_all_cpus_synced(src_cpu, 0, &d);
 }
 
 void tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
@@ -1123,7 +1227,9 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t set = vtlb_set_index(cpu, mmu_idx, tlb_entry_page(te));
+        unsigned vidx = set + desc->vindex[set / CPU_VTLB_WAYS]++
+                        % CPU_VTLB_WAYS;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -1301,27 +1407,45 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
 static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
                            MMUAccessType access_type, vaddr page)
 {
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    size_t vset = vtlb_set_index(cpu, mmu_idx, page);
     size_t vidx;
 
     assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
+    for (vidx = vset; vidx < vset + CPU_VTLB_WAYS; ++vidx) {
+        CPUTLBEntry *vtlb = &desc->vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
         if (cmp == page) {
-            /* Found entry in victim tlb, swap tlb and iotlb.  */
+            /*
+             * Found entry in victim tlb: move it to the main tlb, and
+             * evict the main entry into its own set, which need not be
+             * the set that was hit.
+             */
             CPUTLBEntry tmptlb, *tlb = &cpu->neg.tlb.f[mmu_idx].table[index];
+            CPUTLBEntryFull tmpf = desc->fulltlb[index];
+            size_t oidx = vidx;
 
             qemu_spin_lock(&cpu->neg.tlb.c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
-            copy_tlb_helper_locked(vtlb, &tmptlb);
+            if (tlb_entry_is_empty(&tmptlb)) {
+                memset(vtlb, -1, sizeof(*vtlb));
+            } else {
+                size_t oset = vtlb_set_index(cpu, mmu_idx,
+                                             tlb_entry_page(&tmptlb));
+
+                if (oset != vset) {
+                    oidx = oset + desc->vindex[oset / CPU_VTLB_WAYS]++
+                           % CPU_VTLB_WAYS;
+                    memset(vtlb, -1, sizeof(*vtlb));
+                }
+                copy_tlb_helper_locked(&desc->vtable[oidx], &tmptlb);
+            }
             qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
-            CPUTLBEntryFull *f1 = &cpu->neg.tlb.d[mmu_idx].fulltlb[index];
-            CPUTLBEntryFull *f2 = &cpu->neg.tlb.d[mmu_idx].vfulltlb[vidx];
-            CPUTLBEntryFull tmpf;
-            tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+            desc->fulltlb[index] = desc->vfulltlb[vidx];
+            desc->vfulltlb[oidx] = tmpf;
             return true;
         }
     }
@@ -50,6 +50,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
                               int cflags);
 void page_init(void);
 void tb_htable_init(void);
+void tb_evict(CPUState *cpu);
 void tb_reset_jump(TranslationBlock *tb, int n);
 TranslationBlock *tb_link_page(TranslationBlock *tb);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
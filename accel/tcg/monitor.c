@@ -14,10 +14,12 @@
 #include "qapi/qapi-commands-machine.h"
 #include "monitor/monitor.h"
 #include "system/cpu-timers.h"
+#include "system/stats.h"
 #include "system/tcg.h"
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+#include "tb-jmp-cache.h"
 
 
 static void dump_drift_info(GString *buf)
@@ -125,19 +127,22 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
-static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                             size_t *pbatch)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, batch = 0;
 
     CPU_FOREACH(cpu) {
         full += qatomic_read(&cpu->neg.tlb.c.full_flush_count);
         part += qatomic_read(&cpu->neg.tlb.c.part_flush_count);
         elide += qatomic_read(&cpu->neg.tlb.c.elide_flush_count);
+        batch += qatomic_read(&cpu->neg.tlb.c.batch_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *pbatch = batch;
 }
 
 static void tcg_dump_info(GString *buf)
@@ -149,7 +154,7 @@ static void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, flush_batch;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -188,13 +193,16 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB evict count      %u\n",
+                           qatomic_read(&tb_ctx.tb_evict_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
 
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide, &flush_batch);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB batched flushes %zu\n", flush_batch);
     tcg_dump_info(buf);
 }
 
@@ -234,10 +242,288 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+/*
+ * query-stats support.  VM statistics describe the shared code buffer,
+ * vCPU statistics come from the counters kept next to each jump cache.
+ */
+typedef struct TCGStatDesc {
+    const char *name;
+    StatsTarget target;
+    StatsType type;
+    int unit;               /* StatsUnit, or -1 for a plain count */
+    int exponent;
+    uint64_t (*get)(CPUState *cpu);
+    uint64List *(*get_list)(void);      /* instead of get, for lists */
+} TCGStatDesc;
+
+static uint64_t tcg_stat_tb_count(CPUState *cpu)
+{
+    return tcg_nb_tbs();
+}
+
+static uint64_t tcg_stat_code_size(CPUState *cpu)
+{
+    return tcg_code_size();
+}
+
+static uint64_t tcg_stat_code_capacity(CPUState *cpu)
+{
+    return tcg_code_capacity();
+}
+
+static uint64_t tcg_stat_tb_flushes(CPUState *cpu)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count);
+}
+
+static uint64_t tcg_stat_tb_evictions(CPUState *cpu)
+{
+    return qatomic_read(&tb_ctx.tb_evict_count);
+}
+
+static uint64_t tcg_stat_tb_invalidations(CPUState *cpu)
+{
+    return qatomic_read(&tb_ctx.tb_phys_invalidate_count);
+}
+
+static uint64_t tcg_stat_translation_time(CPUState *cpu)
+{
+    return stat64_get(&tb_ctx.tb_gen_time_ns);
+}
+
+static uint64List *tcg_stat_translation_time_hist(void)
+{
+    uint64List *list = NULL;
+    int i;
+
+    for (i = TB_GEN_TIME_BUCKETS - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(list, qatomic_read(&tb_ctx.tb_gen_time_hist[i]));
+    }
+    return list;
+}
+
+static uint64_t tcg_stat_regions(CPUState *cpu)
+{
+    return tcg_region_count();
+}
+
+static uint64_t tcg_stat_regions_in_use(CPUState *cpu)
+{
+    g_autofree size_t *used = g_new(size_t, tcg_region_count());
+    size_t n_in_use, n_evicted;
+
+    tcg_region_usage(used, &n_in_use, &n_evicted);
+    return n_in_use;
+}
+
+static uint64_t tcg_stat_regions_evicted(CPUState *cpu)
+{
+    g_autofree size_t *used = g_new(size_t, tcg_region_count());
+    size_t n_in_use, n_evicted;
+
+    tcg_region_usage(used, &n_in_use, &n_evicted);
+    return n_evicted;
+}
+
+static uint64List *tcg_stat_region_code_size(void)
+{
+    size_t n = tcg_region_count();
+    g_autofree size_t *used = g_new(size_t, n);
+    size_t n_in_use, n_evicted;
+    uint64List *list = NULL;
+
+    tcg_region_usage(used, &n_in_use, &n_evicted);
+    while (n-- > 0) {
+        QAPI_LIST_PREPEND(list, used[n]);
+    }
+    return list;
+}
+
+#define TCG_VCPU_STAT_GETTER(field)                             \
+static uint64_t tcg_stat_vcpu_##field(CPUState *cpu)            \
+{                                                               \
+    return qatomic_read(&cpu->tb_jmp_cache->stats.field);       \
+}
+
+TCG_VCPU_STAT_GETTER(lookups)
+TCG_VCPU_STAT_GETTER(jc_misses)
+TCG_VCPU_STAT_GETTER(translations)
+TCG_VCPU_STAT_GETTER(exits)
+TCG_VCPU_STAT_GETTER(chains)
+
+static uint64_t tcg_stat_tlb_full_flushes(CPUState *cpu)
+{
+    return qatomic_read(&cpu->neg.tlb.c.full_flush_count);
+}
+
+static uint64_t tcg_stat_tlb_partial_flushes(CPUState *cpu)
+{
+    return qatomic_read(&cpu->neg.tlb.c.part_flush_count);
+}
+
+static uint64_t tcg_stat_tlb_batched_flushes(CPUState *cpu)
+{
+    return qatomic_read(&cpu->neg.tlb.c.batch_flush_count);
+}
+
+static const TCGStatDesc tcg_stats[] = {
+    { "tb-count", STATS_TARGET_VM, STATS_TYPE_INSTANT,
+      -1, 0, tcg_stat_tb_count },
+    { "code-size", STATS_TARGET_VM, STATS_TYPE_INSTANT,
+      STATS_UNIT_BYTES, 0, tcg_stat_code_size },
+    { "code-capacity", STATS_TARGET_VM, STATS_TYPE_INSTANT,
+      STATS_UNIT_BYTES, 0, tcg_stat_code_capacity },
+    { "tb-flushes", STATS_TARGET_VM, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_tb_flushes },
+    { "tb-evictions", STATS_TARGET_VM, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_tb_evictions },
+    { "tb-invalidations", STATS_TARGET_VM, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_tb_invalidations },
+    { "translation-time", STATS_TARGET_VM, STATS_TYPE_CUMULATIVE,
+      STATS_UNIT_SECONDS, -9, tcg_stat_translation_time },
+    { "translation-time-hist", STATS_TARGET_VM, STATS_TYPE_LOG2_HISTOGRAM,
+      STATS_UNIT_SECONDS, -9, NULL, tcg_stat_translation_time_hist },
+    { "regions", STATS_TARGET_VM, STATS_TYPE_INSTANT,
+      -1, 0, tcg_stat_regions },
+    { "regions-in-use", STATS_TARGET_VM, STATS_TYPE_INSTANT,
+      -1, 0, tcg_stat_regions_in_use },
+    { "regions-evicted", STATS_TARGET_VM, STATS_TYPE_INSTANT,
+      -1, 0, tcg_stat_regions_evicted },
+    /* One element per region */
+    { "region-code-size", STATS_TARGET_VM, STATS_TYPE_INSTANT,
+      STATS_UNIT_BYTES, 0, NULL, tcg_stat_region_code_size },
+    { "tb-lookups", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_vcpu_lookups },
+    { "jmp-cache-misses", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_vcpu_jc_misses },
+    { "translations", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_vcpu_translations },
+    { "tb-exits", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_vcpu_exits },
+    { "tb-chains", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_vcpu_chains },
+    { "tlb-full-flushes", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_tlb_full_flushes },
+    { "tlb-partial-flushes", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_tlb_partial_flushes },
+    { "tlb-batched-flushes", STATS_TARGET_VCPU, STATS_TYPE_CUMULATIVE,
+      -1, 0, tcg_stat_tlb_batched_flushes },
+};
+
+static StatsList *tcg_stats_list(StatsTarget target, CPUState *cpu,
+                                 strList *names)
+{
+    StatsList *stats_list = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(tcg_stats); i++) {
+        const TCGStatDesc *desc = &tcg_stats[i];
+        Stats *stats;
+
+        if (desc->target != target ||
+            !apply_str_list_filter(desc->name, names)) {
+            continue;
+        }
+
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(desc->name);
+        stats->value = g_new0(StatsValue, 1);
+        if (desc->get_list) {
+            stats->value->u.list = desc->get_list();
+            stats->value->type = QTYPE_QLIST;
+        } else {
+            stats->value->u.scalar = desc->get(cpu);
+            stats->value->type = QTYPE_QNUM;
+        }
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+    return stats_list;
+}
+
+static void tcg_query_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets, Error **errp)
+{
+    StatsList *stats_list;
+    CPUState *cpu;
+
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    switch (target) {
+    case STATS_TARGET_VM:
+        stats_list = tcg_stats_list(target, NULL, names);
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_TCG, NULL, stats_list);
+        }
+        break;
+    case STATS_TARGET_VCPU:
+        CPU_FOREACH(cpu) {
+            if (!cpu->tb_jmp_cache ||
+                !apply_str_list_filter(cpu->parent_obj.canonical_path,
+                                       targets)) {
+                continue;
+            }
+            stats_list = tcg_stats_list(target, cpu, names);
+            if (stats_list) {
+                add_stats_entry(result, STATS_PROVIDER_TCG,
+                                cpu->parent_obj.canonical_path, stats_list);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static StatsSchemaValueList *tcg_stats_schema_list(StatsTarget target)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(tcg_stats); i++) {
+        const TCGStatDesc *desc = &tcg_stats[i];
+        StatsSchemaValue *value;
+
+        if (desc->target != target) {
+            continue;
+        }
+
+        value = g_new0(StatsSchemaValue, 1);
+        value->name = g_strdup(desc->name);
+        value->type = desc->type;
+        if (desc->unit >= 0) {
+            value->has_unit = true;
+            value->unit = desc->unit;
+        }
+        if (desc->exponent) {
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = desc->exponent;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    return list;
+}
+
+static void tcg_query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VM,
+                     tcg_stats_schema_list(STATS_TARGET_VM));
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VCPU,
+                     tcg_stats_schema_list(STATS_TARGET_VCPU));
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
     monitor_register_hmp_info_hrt("opcount", qmp_x_query_opcount);
+    add_stats_callbacks(STATS_PROVIDER_TCG, tcg_query_stats_cb,
+                        tcg_query_stats_schemas_cb);
 }
 
 type_init(hmp_tcg_register);
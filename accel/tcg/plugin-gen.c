@@ -221,6 +221,119 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(cpu_index);
 }
 
+/*
+ * Append ADDR to the ring.  This is emitted right after a guest memory
+ * access, in the middle of the expansion of an instruction, where we
+ * must not branch: any ebb temp live across a label would be lost.
+ * Room for the accesses of the instruction was made at its start, see
+ * gen_mem_ring_drain(); clamping the index only keeps a misbehaving
+ * instruction from writing past the end of the buffer.
+ */
+static void gen_mem_ring_cb(struct qemu_plugin_ring_cb *cb, TCGv_i64 addr)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->entry);
+    TCGv_ptr slot = tcg_temp_ebb_new_ptr();
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGv_i64 tmp = tcg_temp_ebb_new_i64();
+
+    /* slots[count++] = addr, the slots following the count itself */
+    tcg_gen_ld_i64(count, ptr, 0);
+    tcg_gen_umin_i64(tmp, count, tcg_constant_i64(cb->size - 1));
+    tcg_gen_shli_i64(tmp, tmp, 3);
+    tcg_gen_trunc_i64_ptr(slot, tmp);
+    tcg_gen_add_ptr(slot, slot, ptr);
+    tcg_gen_st_i64(addr, slot, sizeof(uint64_t));
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_umin_i64(count, count, tcg_constant_i64(cb->size));
+    tcg_gen_st_i64(count, ptr, 0);
+
+    tcg_temp_free_i64(tmp);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(slot);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * At the start of an instruction, drain the ring if it does not have
+ * room for the cb->reserve accesses the instruction may append to it.
+ */
+static void gen_mem_ring_drain(struct qemu_plugin_ring_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->entry);
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGLabel *after_cb = gen_new_label();
+    uint64_t limit = cb->reserve < cb->size ? cb->size - cb->reserve : 0;
+
+    tcg_gen_ld_i64(count, ptr, 0);
+    tcg_gen_brcondi_i64(TCG_COND_LEU, count, limit, after_cb);
+    TCGv_i32 cpu_index = gen_cpu_index();
+    tcg_gen_call2(cb->f.vcpu_udata, cb->info, NULL,
+                  tcgv_i32_temp(cpu_index),
+                  tcgv_ptr_temp(tcg_constant_ptr(cb->userp)));
+    tcg_temp_free_i32(cpu_index);
+    tcg_gen_st_i64(tcg_constant_i64(0), ptr, 0);
+    gen_set_label(after_cb);
+
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
+}
+
+static bool ring_cb_match(const struct qemu_plugin_dyn_cb *a,
+                          const struct qemu_plugin_dyn_cb *b)
+{
+    return b->type == PLUGIN_CB_MEM_RING &&
+           a->ring.entry.score == b->ring.entry.score &&
+           a->ring.entry.offset == b->ring.entry.offset;
+}
+
+/*
+ * Count how many entries may be appended to each ring by the memory
+ * accesses of INSN, which follow OP up to the next insn_start, and
+ * drain the rings that do not have enough room left.  This must run
+ * before gen_enable_mem_helper() copies the callbacks, so that the
+ * helper path sees the same reserve.
+ */
+static void inject_mem_ring_drains(TCGOp *op, struct qemu_plugin_insn *insn)
+{
+    GArray *cbs = insn->mem_cbs;
+    int i, j, n = cbs ? cbs->len : 0;
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        TCGOp *o;
+
+        if (cb->type != PLUGIN_CB_MEM_RING) {
+            continue;
+        }
+
+        cb->ring.reserve = 0;
+        for (o = QTAILQ_NEXT(op, link);
+             o && o->opc != INDEX_op_insn_start;
+             o = QTAILQ_NEXT(o, link)) {
+            enum qemu_plugin_mem_rw rw;
+
+            if (o->opc != INDEX_op_plugin_mem_cb) {
+                continue;
+            }
+            rw = qemu_plugin_mem_is_store(o->args[1])
+                 ? QEMU_PLUGIN_MEM_W : QEMU_PLUGIN_MEM_R;
+            /* Several callbacks of this insn may share the same ring */
+            for (j = 0; j < n; j++) {
+                struct qemu_plugin_dyn_cb *other =
+                    &g_array_index(cbs, struct qemu_plugin_dyn_cb, j);
+                if (ring_cb_match(cb, other) && (rw & other->ring.rw)) {
+                    cb->ring.reserve++;
+                }
+            }
+        }
+
+        if (cb->ring.reserve) {
+            gen_mem_ring_drain(&cb->ring);
+        }
+    }
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -258,6 +371,11 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             inject_cb(cb);
         }
         break;
+    case PLUGIN_CB_MEM_RING:
+        if (rw & cb->ring.rw) {
+            gen_mem_ring_cb(&cb->ring, addr);
+        }
+        break;
     default:
         g_assert_not_reached();
     }
@@ -332,6 +450,7 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
             case PLUGIN_GEN_FROM_INSN:
                 assert(insn != NULL);
 
+                inject_mem_ring_drains(op, insn);
                 gen_enable_mem_helper(plugin_tb, insn);
 
                 cbs = insn->insn_cbs;
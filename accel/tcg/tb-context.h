@@ -22,9 +22,24 @@
 
 #include "qemu/thread.h"
 #include "qemu/qht.h"
+#include "qemu/stats64.h"
 
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
+#define CODE_GEN_HTABLE_MAX_BITS 18
+#define CODE_GEN_HTABLE_MAX_SIZE (1 << CODE_GEN_HTABLE_MAX_BITS)
+
+/*
+ * Approximate footprint of one TB in the code buffer: the TranslationBlock
+ * itself, the host code and the search data.  Used to size the hash table.
+ */
+#define CODE_GEN_HTABLE_AVG_TB_BYTES 1024
+
+/*
+ * Buckets of the translation time histogram: bucket 0 counts zero ns,
+ * bucket N counts [2^(N-1), 2^N) ns, the last one everything above.
+ */
+#define TB_GEN_TIME_BUCKETS 32
 
 typedef struct TBContext TBContext;
 
@@ -34,7 +49,10 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_gen_time_hist[TB_GEN_TIME_BUCKETS];
+    Stat64 tb_gen_time_ns;
 };
 
 extern TBContext tb_ctx;
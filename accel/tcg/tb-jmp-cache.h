@@ -24,6 +24,18 @@
  */
 typedef struct CPUJumpCache {
     struct rcu_head rcu;
+    /*
+     * Execution statistics, exported through query-stats.  Only updated
+     * by the owning CPU, so plain increments published with qatomic_set()
+     * are enough; readers use qatomic_read().
+     */
+    struct {
+        size_t lookups;
+        size_t jc_misses;
+        size_t translations;
+        size_t exits;
+        size_t chains;
+    } stats;
     struct {
         TranslationBlock *tb;
         vaddr pc;
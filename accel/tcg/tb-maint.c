@@ -60,11 +60,30 @@ static bool tb_cmp(const void *ap, const void *bp)
             tb_page_addr1(a) == tb_page_addr1(b));
 }
 
+/*
+ * Number of entries the TB hash table is created with, and reset to on
+ * tb_flush.  See tb_htable_init.
+ */
+static size_t tb_htable_size = CODE_GEN_HTABLE_SIZE;
+
+/* Must be called after tcg_init, as it sizes the table by the code buffer. */
 void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
+    size_t n = tcg_code_capacity() / CODE_GEN_HTABLE_AVG_TB_BYTES;
+
+    /*
+     * Size the table for the number of TBs the code buffer is expected
+     * to hold.  Starting from a fixed minimum means that each boot, and
+     * the refill after each tb_flush, goes through a series of resizes,
+     * each done with the whole table locked, while the guest executes
+     * the most new code.
+     */
+    n = MAX(n, CODE_GEN_HTABLE_SIZE);
+    n = MIN(n, CODE_GEN_HTABLE_MAX_SIZE);
+    tb_htable_size = n;
 
-    qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    qht_init(&tb_ctx.htable, tb_cmp, tb_htable_size, mode);
 }
 
 typedef struct PageDesc PageDesc;
@@ -775,7 +794,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
         tcg_flush_jmp_cache(cpu);
     }
 
-    qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
+    qht_reset_size(&tb_ctx.htable, tb_htable_size);
     tb_remove_all();
 
     tcg_region_reset_all();
@@ -843,7 +862,12 @@ static inline void tb_remove_from_jmp_list(TranslationBlock *orig, int n_orig)
     TB_FOR_EACH_JMP(dest, tb, n) {
         if (tb == orig && n == n_orig) {
             *pprev = tb->jmp_list_next[n];
-            /* no need to set orig->jmp_dest[n]; setting the LSB was enough */
+            /*
+             * Keep the LSB set so that no jump can be inserted, but drop
+             * the destination: @dest may be freed along with its region
+             * while @orig lingers, and must not be looked at again.
+             */
+            qatomic_set(&orig->jmp_dest[n_orig], 1);
             qemu_spin_unlock(&dest->jmp_lock);
             return;
         }
@@ -905,8 +929,11 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
+ * Return false if @tb was not in the hash table, in which case it is
+ * marked invalid but its jumps are left alone.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static bool do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  bool rm_from_jmp_cache)
 {
     uint32_t h;
     tb_page_addr_t phys_pc;
@@ -924,7 +951,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     h = tb_hash_func(phys_pc, (orig_cflags & CF_PCREL ? 0 : tb->pc),
                      tb->flags, tb->cs_base, orig_cflags);
     if (!qht_remove(&tb_ctx.htable, tb, h)) {
-        return;
+        return false;
     }
 
     /* remove the TB from the page list */
@@ -933,7 +960,9 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (rm_from_jmp_cache) {
+        tb_jmp_cache_inval_tb(tb);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -944,12 +973,13 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 
     qatomic_set(&tb_ctx.tb_phys_invalidate_count,
                 tb_ctx.tb_phys_invalidate_count + 1);
+    return true;
 }
 
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
 {
     qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
+    do_tb_phys_invalidate(tb, true, true);
     qemu_thread_jit_execute();
 }
 
@@ -961,10 +991,105 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb_page_addr0(tb) != -1) {
         tb_lock_pages(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, true);
         tb_unlock_pages(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, true);
+    }
+}
+
+static gboolean tb_evict_one(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    bool unlinked = false;
+
+    /* TBs invalidated earlier had their jumps removed back then. */
+    if (tb_cflags(tb) & CF_INVALID) {
+        return false;
+    }
+
+    if (tb_page_addr0(tb) != -1) {
+        tb_lock_pages(tb);
+        unlinked = do_tb_phys_invalidate(tb, true, false);
+        tb_unlock_pages(tb);
+    }
+
+    /*
+     * TBs that never made it into the hash table are not unlinked by
+     * do_tb_phys_invalidate, but may still be chained to or from TBs
+     * that survive the eviction.
+     */
+    if (!unlinked) {
+        qemu_spin_lock(&tb->jmp_lock);
+        qatomic_set(&tb->cflags, tb->cflags | CF_INVALID);
+        qemu_spin_unlock(&tb->jmp_lock);
+
+        tb_remove_from_jmp_list(tb, 0);
+        tb_remove_from_jmp_list(tb, 1);
+        tb_jmp_unlink(tb);
+    }
+    return false;
+}
+
+/*
+ * Changes whenever the code buffer is flushed or a region is evicted,
+ * so that concurrent requests to make room are only served once.
+ */
+static unsigned tb_evict_gen(void)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count) +
+           qatomic_read(&tb_ctx.tb_evict_count);
+}
+
+/* recycle the oldest region of the code buffer */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data evict_gen)
+{
+    CPUState *other;
+    bool did_evict;
+
+    mmap_lock();
+    /* A flush or eviction since the request has already made room. */
+    if (tb_evict_gen() != evict_gen.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    qemu_thread_jit_write();
+    did_evict = tcg_region_evict(tb_evict_one, NULL);
+    qemu_thread_jit_execute();
+    if (did_evict) {
+        /*
+         * Flush the jump caches once rather than searching them for
+         * every evicted TB, which for CF_PCREL means a flush per TB.
+         */
+        CPU_FOREACH(other) {
+            tcg_flush_jmp_cache(other);
+        }
+        qatomic_inc(&tb_ctx.tb_evict_count);
+    }
+    mmap_unlock();
+
+    /* Every region is still in use: nothing for it but a full flush. */
+    if (!did_evict) {
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+    }
+}
+
+/*
+ * Make room in the code buffer.  Unlike tb_flush, only the translations
+ * in the least recently allocated region are discarded, so the other
+ * vCPUs keep their hot code.  As with tb_flush, the work is done in an
+ * exclusive context.
+ */
+void tb_evict(CPUState *cpu)
+{
+    unsigned evict_gen = tb_evict_gen();
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(evict_gen));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(evict_gen));
     }
 }
 
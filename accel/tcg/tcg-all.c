@@ -116,8 +116,8 @@ static int tcg_init_machine(MachineState *ms)
     mttcg_enabled = s->mttcg_enabled;
 
     page_init();
-    tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    tb_htable_init();
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -52,6 +52,7 @@
 #include "qemu/qemu-print.h"
 #include "qemu/main-loop.h"
 #include "qemu/cacheinfo.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "exec/log.h"
 #include "system/cpu-timers.h"
@@ -286,6 +287,15 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
+/* Record the time spent translating one TB, for query-stats.  */
+static void tb_gen_time_account(int64_t ns)
+{
+    int bucket = ns > 0 ? MIN(64 - clz64(ns), TB_GEN_TIME_BUCKETS - 1) : 0;
+
+    qatomic_inc(&tb_ctx.tb_gen_time_hist[bucket]);
+    stat64_add(&tb_ctx.tb_gen_time_ns, ns);
+}
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               vaddr pc, uint64_t cs_base,
@@ -301,6 +311,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
     assert_memory_lock();
     qemu_thread_jit_write();
+    ti = get_clock();
 
     phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
 
@@ -319,8 +330,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* some code must be discarded */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -536,6 +547,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      * lookup itself using host PC.
      */
     tcg_tb_insert(tb);
+    tb_gen_time_account(get_clock() - ti);
 
     /*
      * If the TB is not associated with a physical RAM page then it must be
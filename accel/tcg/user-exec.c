@@ -24,6 +24,7 @@
 #include "tcg/tcg.h"
 #include "qemu/bitops.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "exec/cpu_ldst.h"
 #include "user/cpu_loop.h"
 #include "qemu/main-loop.h"
@@ -159,6 +160,15 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Lockless lookups in pageflags_root may miss a node while the tree is
+ * being rebalanced; see util/interval-tree.c.  Writers, serialized by
+ * mmap_lock, bump this sequence around every modification, so that a
+ * reader whose lookup failed can tell whether the miss is genuine
+ * without having to take mmap_lock itself.
+ */
+static QemuSeqLock pageflags_seq;
+
 static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n;
@@ -222,17 +232,18 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
+    unsigned seq = seqlock_read_begin(&pageflags_seq);
     PageFlagsNode *p = pageflags_find(address, address);
 
     /*
      * See util/interval-tree.c re lockless lookups: no false positives but
-     * there are false negatives.  If we find nothing, retry with the mmap
-     * lock acquired.
+     * there are false negatives.  If we find nothing while the tree was
+     * being modified, retry with the mmap lock acquired.
      */
     if (p) {
         return p->flags;
     }
-    if (have_mmap_lock()) {
+    if (have_mmap_lock() || !seqlock_read_retry(&pageflags_seq, seq)) {
         return 0;
     }
 
@@ -517,6 +528,7 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
         }
     }
 
+    seqlock_write_begin(&pageflags_seq);
     if (!flags || reset) {
         page_reset_target_data(start, last);
         inval_tb |= pageflags_unset(start, last);
@@ -525,6 +537,7 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
         inval_tb |= pageflags_set_clear(start, last, flags,
                                         ~(reset ? 0 : PAGE_STICKY));
     }
+    seqlock_write_end(&pageflags_seq);
     if (inval_tb) {
         tb_invalidate_phys_range(start, last);
     }
@@ -532,8 +545,9 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
 
 bool page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    target_ulong last;
+    target_ulong first, last;
     int locked;  /* tri-state: =0: unlocked, +1: global, -1: local */
+    unsigned seq;
     bool ret;
 
     if (len == 0) {
@@ -545,25 +559,17 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         return false; /* wrap around */
     }
 
+    first = start;
     locked = have_mmap_lock();
+    seq = seqlock_read_begin(&pageflags_seq);
+ retry:
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         int missing;
 
         if (!p) {
-            if (!locked) {
-                /*
-                 * Lockless lookups have false negatives.
-                 * Retry with the lock held.
-                 */
-                mmap_lock();
-                locked = -1;
-                p = pageflags_find(start, last);
-            }
-            if (!p) {
-                ret = false; /* entire region invalid */
-                break;
-            }
+            ret = false; /* entire region invalid */
+            break;
         }
         if (start < p->itree.start) {
             ret = false; /* initial bytes invalid */
@@ -601,6 +607,17 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         start = p->itree.last + 1;
     }
 
+    /*
+     * Lockless lookups have false negatives, but only while the tree is
+     * being modified.  If that happened, retry with the lock held.
+     */
+    if (!ret && !locked && seqlock_read_retry(&pageflags_seq, seq)) {
+        mmap_lock();
+        locked = -1;
+        start = first;
+        goto retry;
+    }
+
     /* Release the lock if acquired locally. */
     if (locked < 0) {
         mmap_unlock();
@@ -688,7 +705,9 @@ void page_protect(tb_page_addr_t address)
     }
 
     if (prot & PAGE_WRITE) {
+        seqlock_write_begin(&pageflags_seq);
         pageflags_set_clear(start, last, 0, PAGE_WRITE);
+        seqlock_write_end(&pageflags_seq);
         mprotect(g2h_untagged(start), last - start + 1,
                  prot & (PAGE_READ | PAGE_EXEC) ? PROT_READ : PROT_NONE);
     }
@@ -743,7 +762,9 @@ int page_unprotect(tb_page_addr_t address, uintptr_t pc)
             start = address & TARGET_PAGE_MASK;
             len = TARGET_PAGE_SIZE;
             prot = p->flags | PAGE_WRITE;
+            seqlock_write_begin(&pageflags_seq);
             pageflags_set_clear(start, start + len - 1, PAGE_WRITE, 0);
+            seqlock_write_end(&pageflags_seq);
             current_tb_invalidated = tb_invalidate_phys_page_unwind(start, pc);
         } else {
             start = address & -host_page_size;
@@ -758,8 +779,10 @@ int page_unprotect(tb_page_addr_t address, uintptr_t pc)
                     prot |= p->flags;
                     if (p->flags & PAGE_WRITE_ORG) {
                         prot |= PAGE_WRITE;
+                        seqlock_write_begin(&pageflags_seq);
                         pageflags_set_clear(addr, addr + TARGET_PAGE_SIZE - 1,
                                             PAGE_WRITE, 0);
+                        seqlock_write_end(&pageflags_seq);
                     }
                 }
                 /*
@@ -17,6 +17,7 @@
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "system/block-backend.h"
 #include "trace.h"
 
@@ -26,6 +27,14 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Idle time after which the SQPOLL kernel thread goes to sleep */
+#define SQPOLL_IDLE_MS 1000
+
+/* Linux 5.11 */
+#ifndef IORING_FEAT_SQPOLL_NONFIXED
+#define IORING_FEAT_SQPOLL_NONFIXED (1U << 7)
+#endif
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -432,7 +441,7 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(bool sqpoll, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
@@ -440,6 +449,32 @@ LuringState *luring_init(Error **errp)
 
     trace_luring_init_state(s, sizeof(*s));
 
+    if (sqpoll) {
+        struct io_uring_params params = {
+            .flags = IORING_SETUP_SQPOLL,
+            .sq_thread_idle = SQPOLL_IDLE_MS,
+        };
+
+        /*
+         * Before Linux 5.11 SQPOLL needs CAP_SYS_ADMIN and registered
+         * files; do not fail I/O because of that, just use a plain ring.
+         * With CAP_SYS_ADMIN the ring is created anyway, but requests on
+         * unregistered fds would fail with EBADF, so check the feature.
+         */
+        rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+        if (rc == 0) {
+            if (params.features & IORING_FEAT_SQPOLL_NONFIXED) {
+                goto out;
+            }
+            io_uring_queue_exit(ring);
+            warn_report_once("io_uring submission polling unavailable: "
+                             "kernel requires registered files");
+        } else {
+            warn_report_once("io_uring submission polling unavailable: %s",
+                             strerror(-rc));
+        }
+    }
+
     rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
@@ -447,6 +482,7 @@ LuringState *luring_init(Error **errp)
         return NULL;
     }
 
+out:
     ioq_init(&s->io_q);
     return s;
 
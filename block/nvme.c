@@ -23,6 +23,7 @@
 #include "qemu/cutils.h"
 #include "qemu/option.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 #include "qemu/vfio-helpers.h"
 #include "block/block-io.h"
 #include "block/block_int.h"
@@ -79,6 +80,9 @@ typedef struct {
     BDRVNVMeState   *s;
     int             index;
 
+    /* AioContext that submits on this I/O queue, claimed on first use */
+    AioContext      *owner;
+
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
 
@@ -134,15 +138,17 @@ struct BDRVNVMeState {
     /* PCI address (required for nvme_refresh_filename()) */
     char *device;
 
+    /* Updated from every AioContext that submits to or polls a queue */
     struct {
-        uint64_t completion_errors;
-        uint64_t aligned_accesses;
-        uint64_t unaligned_accesses;
+        Stat64 completion_errors;
+        Stat64 aligned_accesses;
+        Stat64 unaligned_accesses;
     } stats;
 };
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_IO_QUEUES "io-queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -160,6 +166,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_IO_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs to create (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -208,10 +219,21 @@ static void nvme_free_queue_pair(NVMeQueuePair *q)
 static void nvme_free_req_queue_cb(void *opaque)
 {
     NVMeQueuePair *q = opaque;
+    int i, n = 0;
 
     qemu_mutex_lock(&q->lock);
-    while (q->free_req_head != -1 &&
-           qemu_co_enter_next(&q->free_req_queue, &q->lock)) {
+    for (i = q->free_req_head; i != -1; i = q->reqs[i].free_req_next) {
+        n++;
+    }
+
+    /*
+     * Waiters can belong to any AioContext that shares this queue.
+     * qemu_co_enter_next() uses aio_co_wake(), which only schedules
+     * coroutines of other contexts, so they do not take their request
+     * before we look at the free list again.  Wake at most one waiter
+     * per free request; anyone who loses the race waits again.
+     */
+    while (n-- > 0 && qemu_co_enter_next(&q->free_req_queue, &q->lock)) {
         /* Retry waiting requests */
     }
     qemu_mutex_unlock(&q->lock);
@@ -344,7 +366,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(qemu_get_current_aio_context(),
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -385,6 +407,7 @@ static bool nvme_process_completion(NVMeQueuePair *q)
 {
     BDRVNVMeState *s = q->s;
     bool progress = false;
+    bool home = qemu_get_current_aio_context() == s->aio_context;
     NVMeRequest *preq;
     NVMeRequest req;
     NvmeCqe *c;
@@ -398,8 +421,16 @@ static bool nvme_process_completion(NVMeQueuePair *q)
      *
      * The aio_poll() loop will execute our BH and we'll resume completion
      * processing there.
+     *
+     * The BH lives in the BDS AioContext, so only that context touches it.
+     * Scheduling it from a submitting iothread would cost an aio_notify()
+     * per kick, and cancelling it could pull it from under a cb() of the
+     * BDS AioContext.  Completions a cb() in another iothread waits for
+     * are still picked up by the interrupt handler in the BDS AioContext.
      */
-    qemu_bh_schedule(q->completion_bh);
+    if (home) {
+        qemu_bh_schedule(q->completion_bh);
+    }
 
     assert(q->inflight >= 0);
     while (q->inflight) {
@@ -412,11 +443,11 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         }
         ret = nvme_translate_error(c);
         if (ret) {
-            s->stats.completion_errors++;
+            stat64_inc(&s->stats.completion_errors);
         }
-        q->cq.head = (q->cq.head + 1) % NVME_QUEUE_SIZE;
+        qatomic_set(&q->cq.head, (q->cq.head + 1) % NVME_QUEUE_SIZE);
         if (!q->cq.head) {
-            q->cq_phase = !q->cq_phase;
+            qatomic_set(&q->cq_phase, !q->cq_phase);
         }
         cid = le16_to_cpu(c->cid);
         if (cid == 0 || cid > NVME_NUM_REQS) {
@@ -445,7 +476,9 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         nvme_wake_free_req_locked(q);
     }
 
-    qemu_bh_cancel(q->completion_bh);
+    if (home) {
+        qemu_bh_cancel(q->completion_bh);
+    }
 
     return progress;
 }
@@ -458,7 +491,13 @@ static void nvme_process_completion_bh(void *opaque)
      * We're being invoked because a nvme_process_completion() cb() function
      * called aio_poll(). The callback may be waiting for further completions
      * so notify the device that it has space to fill in more completions now.
+     *
+     * The BH lives in the BDS AioContext, while the queue may also be
+     * processed by the iothread that submits to it, so take q->lock.
+     * nvme_process_completion() drops it around cb(), so it is not held
+     * by the caller that scheduled us.
      */
+    QEMU_LOCK_GUARD(&q->lock);
     smp_mb_release();
     *q->cq.doorbell = cpu_to_le32(q->cq.head);
     nvme_wake_free_req_locked(q);
@@ -627,24 +666,26 @@ out:
 
 static void nvme_poll_queue(NVMeQueuePair *q)
 {
-    const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
-    NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
+    size_t cqe_offset;
+    NvmeCqe *cqe;
 
     trace_nvme_poll_queue(q->s, q->index);
     /*
-     * Do an early check for completions. q->lock isn't needed because
-     * nvme_process_completion() only runs in the event loop thread and
-     * cannot race with itself.
+     * The iothread that submits to this queue also processes completions,
+     * so cq.head and cq_phase are only stable under q->lock.  Checking
+     * them without the lock could miss the completions that raised the
+     * interrupt we are handling.
      */
+    QEMU_LOCK_GUARD(&q->lock);
+    cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
+    cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
     if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
         return;
     }
 
-    qemu_mutex_lock(&q->lock);
     while (nvme_process_completion(q)) {
         /* Keep polling */
     }
-    qemu_mutex_unlock(&q->lock);
 }
 
 static void nvme_poll_queues(BDRVNVMeState *s)
@@ -718,14 +759,17 @@ static bool nvme_poll_cb(void *opaque)
 
     for (i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
-        const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
+        const size_t cqe_offset =
+            qatomic_read(&q->cq.head) * NVME_CQ_ENTRY_BYTES;
         NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
 
         /*
-         * q->lock isn't needed because nvme_process_completion() only runs in
-         * the event loop thread and cannot race with itself.
+         * This runs without q->lock while the submitting iothread may be
+         * processing completions.  A stale head or phase can only cause a
+         * spurious nvme_poll_ready() call, which takes the lock and checks
+         * again, or a delay until the next poll.
          */
-        if ((le16_to_cpu(cqe->status) & 0x1) != q->cq_phase) {
+        if ((le16_to_cpu(cqe->status) & 0x1) != qatomic_read(&q->cq_phase)) {
             return true;
         }
     }
@@ -740,8 +784,52 @@ static void nvme_poll_ready(EventNotifier *e)
     nvme_poll_queues(s);
 }
 
+/*
+ * Ask the controller for @n I/O queue pairs.  Controllers may grant
+ * fewer; nvme_add_io_queue() failing tells us where the limit is.
+ */
+static void nvme_set_num_io_queues(BlockDriverState *bs, unsigned n)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((n - 1) << 16) | (n - 1)),
+    };
+
+    if (nvme_admin_cmd_sync(bs, &cmd)) {
+        trace_nvme_set_num_io_queues_failed(bs->opaque, n);
+    }
+}
+
+/*
+ * Return the I/O queue for the current AioContext.  With the multiqueue
+ * block layer each iothread gets its own hardware queue pair, as long as
+ * there are enough of them, so that submissions from different threads
+ * do not contend on q->lock.  AioContexts beyond the number of queues
+ * share them.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned nr_io = s->queue_count - 1;
+    unsigned i;
+
+    for (i = 0; i < nr_io; i++) {
+        NVMeQueuePair *q = s->queues[INDEX_IO(i)];
+        AioContext *owner = qatomic_read(&q->owner);
+
+        if (owner == ctx) {
+            return q;
+        }
+        if (!owner && !qatomic_cmpxchg(&q->owner, NULL, ctx)) {
+            return q;
+        }
+    }
+    return s->queues[INDEX_IO(g_direct_hash(ctx) % nr_io)];
+}
+
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -752,6 +840,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     uint64_t timeout_ms;
     uint64_t deadline, now;
     volatile NvmeBar *regs = NULL;
+    unsigned max_io_queues;
 
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
@@ -880,9 +969,29 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
-    /* Set up command queues. */
+    /* Set up command queues, as many as have doorbells in the mapped BAR. */
+    max_io_queues = (NVME_DOORBELL_SIZE / sizeof(*s->doorbells) - 1) /
+                    s->doorbell_scale;
+    if (io_queues > max_io_queues) {
+        warn_report("Using %u of %u NVMe I/O queues", max_io_queues,
+                    io_queues);
+        io_queues = max_io_queues;
+    }
+    if (io_queues > 1) {
+        nvme_set_num_io_queues(bs, io_queues);
+    }
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    while (s->queue_count <= io_queues) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            warn_reportf_err(local_err, "Using %u of %u NVMe I/O queues: ",
+                             s->queue_count - 1, io_queues);
+            break;
+        }
     }
 out:
     if (regs) {
@@ -973,6 +1082,7 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -988,7 +1098,14 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_IO_QUEUES, 1);
+    if (io_queues < 1 || io_queues > UINT16_MAX) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_IO_QUEUES "' must be between "
+                   "1 and %u", UINT16_MAX);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1166,17 +1283,20 @@ typedef struct {
 static void nvme_rw_cb_bh(void *opaque)
 {
     NVMeCoData *data = opaque;
-    qemu_coroutine_enter(data->co);
+    aio_co_wake(data->co);
 }
 
+/*
+ * The request may be completed by any thread that processes its queue,
+ * not only by the submitting one.  The coroutine always yields exactly
+ * once after submitting and is only woken by the BH in its own
+ * AioContext, so @data stays valid until the BH has run and the store
+ * to data->ret is ordered before the wakeup by the BH scheduling.
+ */
 static void nvme_rw_cb(void *opaque, int ret)
 {
     NVMeCoData *data = opaque;
     data->ret = ret;
-    if (!data->co) {
-        /* The rw coroutine hasn't yielded, don't try to enter. */
-        return;
-    }
     replay_bh_schedule_oneshot_event(data->ctx, nvme_rw_cb_bh, data);
 }
 
@@ -1188,7 +1308,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1201,7 +1321,8 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1219,10 +1340,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
     }
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
 
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    qemu_coroutine_yield();
 
     qemu_co_mutex_lock(&s->dma_map_lock);
     r = nvme_cmd_unmap_qiov(bs, qiov);
@@ -1267,10 +1385,10 @@ static coroutine_fn int nvme_co_prw(BlockDriverState *bs,
     assert(QEMU_IS_ALIGNED(bytes, s->page_size));
     assert(bytes <= s->max_transfer);
     if (nvme_qiov_aligned(bs, qiov)) {
-        s->stats.aligned_accesses++;
+        stat64_inc(&s->stats.aligned_accesses);
         return nvme_co_prw_aligned(bs, offset, bytes, qiov, is_write, flags);
     }
-    s->stats.unaligned_accesses++;
+    stat64_inc(&s->stats.unaligned_accesses);
     trace_nvme_prw_buffered(s, offset, bytes, qiov->niov, is_write);
     buf = qemu_try_memalign(qemu_real_host_page_size(), len);
 
@@ -1309,14 +1427,15 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1325,10 +1444,7 @@ static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
     assert(req);
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
 
-    data.co = qemu_coroutine_self();
-    if (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    qemu_coroutine_yield();
 
     return data.ret;
 }
@@ -1340,7 +1456,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1367,7 +1483,8 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1388,10 +1505,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
 
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
 
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    qemu_coroutine_yield();
 
     trace_nvme_rw_done(s, true, offset, bytes, data.ret);
     return data.ret;
@@ -1403,7 +1517,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -1417,7 +1531,8 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1463,10 +1578,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
 
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
 
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    qemu_coroutine_yield();
 
     qemu_co_mutex_lock(&s->dma_map_lock);
     ret = nvme_cmd_unmap_qiov(bs, &local_qiov);
@@ -1543,6 +1655,22 @@ static void nvme_refresh_limits(BlockDriverState *bs, Error **errp)
                                     1UL << s->blkshift);
 }
 
+/*
+ * Queue pairs are claimed by the first AioContext that submits to them.
+ * A device quiesces its BlockBackend before it lets go of an iothread, so
+ * forget the owners here and let the contexts that keep submitting
+ * claim their queues again; otherwise a dead iothread would keep its
+ * queue pair for good.
+ */
+static void nvme_drain_begin(BlockDriverState *bs)
+{
+    BDRVNVMeState *s = bs->opaque;
+
+    for (unsigned i = 0; i < s->queue_count; i++) {
+        qatomic_set(&s->queues[i]->owner, NULL);
+    }
+}
+
 static void nvme_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
@@ -1606,9 +1734,9 @@ static BlockStatsSpecific *nvme_get_specific_stats(BlockDriverState *bs)
 
     stats->driver = BLOCKDEV_DRIVER_NVME;
     stats->u.nvme = (BlockStatsSpecificNvme) {
-        .completion_errors = s->stats.completion_errors,
-        .aligned_accesses = s->stats.aligned_accesses,
-        .unaligned_accesses = s->stats.unaligned_accesses,
+        .completion_errors = stat64_get(&s->stats.completion_errors),
+        .aligned_accesses = stat64_get(&s->stats.aligned_accesses),
+        .unaligned_accesses = stat64_get(&s->stats.unaligned_accesses),
     };
 
     return stats;
@@ -1650,6 +1778,7 @@ static BlockDriver bdrv_nvme = {
     .strong_runtime_opts      = nvme_strong_runtime_opts,
     .bdrv_get_specific_stats  = nvme_get_specific_stats,
 
+    .bdrv_drain_begin         = nvme_drain_begin,
     .bdrv_detach_aio_context  = nvme_detach_aio_context,
     .bdrv_attach_aio_context  = nvme_attach_aio_context,
 
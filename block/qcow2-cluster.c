@@ -70,6 +70,7 @@ int coroutine_fn qcow2_shrink_l1_table(BlockDriverState *bs,
                             s->cluster_size, QCOW2_DISCARD_ALWAYS);
         s->l1_table[i] = 0;
     }
+    qcow2_extent_cache_clear(s);
     return 0;
 
 fail:
@@ -563,6 +564,97 @@ do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
 }
 
 
+void qcow2_extent_cache_clear(BDRVQcow2State *s)
+{
+    s->extent_root = (IntervalTreeRoot) {};
+    s->nb_extents = 0;
+}
+
+/*
+ * Remove @ext from the cache.  The last extent in s->extents takes its
+ * place, so that s->extents[0..nb_extents-1] are always in use.
+ */
+static void qcow2_extent_cache_remove(BDRVQcow2State *s, Qcow2Extent *ext)
+{
+    Qcow2Extent *last = &s->extents[s->nb_extents - 1];
+
+    interval_tree_remove(&ext->node, &s->extent_root);
+    if (ext != last) {
+        interval_tree_remove(&last->node, &s->extent_root);
+        *ext = *last;
+        interval_tree_insert(&ext->node, &s->extent_root);
+    }
+    s->nb_extents--;
+}
+
+/*
+ * Drop all extents that overlap the guest range [@offset, @offset + @bytes).
+ * Must be called whenever the L2 entries for that range change.
+ */
+void qcow2_extent_cache_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                   uint64_t bytes)
+{
+    uint64_t last = offset + bytes - 1;
+    IntervalTreeNode *node;
+
+    while ((node = interval_tree_iter_first(&s->extent_root, offset, last))) {
+        qcow2_extent_cache_remove(s, container_of(node, Qcow2Extent, node));
+    }
+}
+
+static Qcow2Extent *qcow2_extent_cache_lookup(BDRVQcow2State *s,
+                                              uint64_t offset)
+{
+    IntervalTreeNode *node;
+
+    node = interval_tree_iter_first(&s->extent_root, offset, offset);
+    return node ? container_of(node, Qcow2Extent, node) : NULL;
+}
+
+/*
+ * Remember that @bytes bytes of guest data starting at @offset are stored
+ * contiguously at @host_offset.  Once QCOW2_MAX_EXTENTS are in use, the
+ * whole cache is dropped.
+ */
+static void qcow2_extent_cache_add(BDRVQcow2State *s, uint64_t offset,
+                                   uint64_t bytes, uint64_t host_offset)
+{
+    uint64_t last = offset + bytes - 1;
+    IntervalTreeNode *node;
+    Qcow2Extent *ext;
+
+    qcow2_extent_cache_invalidate(s, offset, bytes);
+
+    /* Extend the preceding extent if it is contiguous in the image file */
+    if (offset > 0) {
+        node = interval_tree_iter_first(&s->extent_root, offset - 1,
+                                        offset - 1);
+        if (node) {
+            ext = container_of(node, Qcow2Extent, node);
+            if (ext->host_offset + (offset - node->start) == host_offset) {
+                interval_tree_remove(node, &s->extent_root);
+                node->last = last;
+                interval_tree_insert(node, &s->extent_root);
+                return;
+            }
+        }
+    }
+
+    if (s->nb_extents == QCOW2_MAX_EXTENTS) {
+        qcow2_extent_cache_clear(s);
+    }
+    if (!s->extents) {
+        s->extents = g_new(Qcow2Extent, QCOW2_MAX_EXTENTS);
+    }
+
+    ext = &s->extents[s->nb_extents++];
+    ext->node.start = offset;
+    ext->node.last = last;
+    ext->host_offset = host_offset;
+    interval_tree_insert(&ext->node, &s->extent_root);
+}
+
+
 /*
  * get_host_offset
  *
@@ -594,8 +686,17 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     unsigned int offset_in_cluster;
     uint64_t bytes_available, bytes_needed, nb_clusters;
     QCow2SubclusterType type;
+    Qcow2Extent *ext;
     int ret;
 
+    ext = qcow2_extent_cache_lookup(s, offset);
+    if (ext) {
+        *host_offset = ext->host_offset + (offset - ext->node.start);
+        *bytes = MIN(*bytes, ext->node.last - offset + 1);
+        *subcluster_type = QCOW2_SUBCLUSTER_NORMAL;
+        return 0;
+    }
+
     offset_in_cluster = offset_into_cluster(s, offset);
     bytes_needed = (uint64_t) *bytes + offset_in_cluster;
 
@@ -718,6 +819,34 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
         ret = -EIO;
         goto fail;
     }
+
+    if (type == QCOW2_SUBCLUSTER_NORMAL) {
+        int ext_sc = sc;
+        uint64_t scanned = ((uint64_t) sc + sc_index) << s->subcluster_bits;
+
+        /*
+         * If the data continues past the end of the request, look a bit
+         * further ahead in the L2 slice so that the following requests hit
+         * the extent cache.  Sequential readers find the next part when they
+         * get there, and it is merged into this extent.
+         */
+        if (scanned >= bytes_needed &&
+            l2_index + nb_clusters < s->l2_slice_size) {
+            unsigned ext_l2_index = l2_index;
+            uint64_t ext_clusters = MIN(nb_clusters + QCOW2_EXTENT_SCAN_AHEAD,
+                                        s->l2_slice_size - l2_index);
+            ext_sc = count_contiguous_subclusters(bs, ext_clusters,
+                                                  sc_index, l2_slice,
+                                                  &ext_l2_index);
+        }
+        if (ext_sc > 0) {
+            uint64_t ext_offset = (uint64_t) sc_index << s->subcluster_bits;
+            qcow2_extent_cache_add(s, offset - offset_in_cluster + ext_offset,
+                                   (uint64_t) ext_sc << s->subcluster_bits,
+                                   (l2_entry & L2E_OFFSET_MASK) + ext_offset);
+        }
+    }
+
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
     bytes_available = ((int64_t)sc + sc_index) << s->subcluster_bits;
@@ -874,6 +1003,8 @@ qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs, uint64_t offset,
 
     BLKDBG_CO_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    qcow2_extent_cache_invalidate(s, start_of_cluster(s, offset),
+                                  s->cluster_size);
     set_l2_entry(s, l2_slice, l2_index, cluster_offset);
     if (has_subclusters(s)) {
         set_l2_bitmap(s, l2_slice, l2_index, 0);
@@ -1062,6 +1193,8 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
         goto err;
     }
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    qcow2_extent_cache_invalidate(s, m->offset,
+                                  (uint64_t)m->nb_clusters << s->cluster_bits);
 
     assert(l2_index + m->nb_clusters <= s->l2_slice_size);
     assert(m->cow_end.offset + m->cow_end.nb_bytes <=
@@ -1620,13 +1753,24 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+        int64_t cluster_offset;
+        if (s->alloc_pool_size) {
+            cluster_offset = qcow2_alloc_pool_get(bs, nb_clusters);
+        } else {
+            cluster_offset =
+                qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+        }
         if (cluster_offset < 0) {
             return cluster_offset;
         }
         *host_offset = cluster_offset;
         return 0;
+    } else if (s->alloc_pool_remaining &&
+               *host_offset == s->alloc_pool_offset) {
+        /* The pool continues right where the previous allocation ended */
+        int64_t ret = qcow2_alloc_pool_get(bs, nb_clusters);
+        assert(ret == *host_offset);
+        return 0;
     } else {
         int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
         if (ret < 0) {
@@ -1971,6 +2115,9 @@ discard_in_l2_slice(BlockDriverState *bs, uint64_t offset, uint64_t nb_clusters,
 
         /* First remove L2 entries */
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+        qcow2_extent_cache_invalidate(s, offset +
+                                      ((uint64_t)i << s->cluster_bits),
+                                      s->cluster_size);
         set_l2_entry(s, l2_slice, l2_index + i, new_l2_entry);
         if (has_subclusters(s)) {
             set_l2_bitmap(s, l2_slice, l2_index + i, new_l2_bitmap);
@@ -2083,6 +2230,9 @@ zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
 
         /* First update L2 entries */
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+        qcow2_extent_cache_invalidate(s, offset +
+                                      ((uint64_t)i << s->cluster_bits),
+                                      s->cluster_size);
         set_l2_entry(s, l2_slice, l2_index + i, new_l2_entry);
         if (has_subclusters(s)) {
             set_l2_bitmap(s, l2_slice, l2_index + i, new_l2_bitmap);
@@ -2145,6 +2295,9 @@ zero_l2_subclusters(BlockDriverState *bs, uint64_t offset,
     if (old_l2_bitmap != l2_bitmap) {
         set_l2_bitmap(s, l2_slice, l2_index, l2_bitmap);
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+        qcow2_extent_cache_invalidate(s, offset,
+                                      (uint64_t)nb_subclusters <<
+                                      s->subcluster_bits);
     }
 
     ret = 0;
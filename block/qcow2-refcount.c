@@ -1065,6 +1065,61 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/*
+ * Allocates up to *nb_clusters contiguous clusters for guest data from the
+ * allocation pool, refilling the pool first if it is empty.  This way, the
+ * refcount lookups and updates for the allocation are done once per
+ * s->alloc_pool_size clusters instead of once per write request.
+ *
+ * On success, the offset of the first cluster is returned and *nb_clusters
+ * is set to the number of clusters actually taken from the pool, which may
+ * be less than requested.  Returns -errno on failure.
+ */
+int64_t qcow2_alloc_pool_get(BlockDriverState *bs, uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t offset;
+
+    assert(*nb_clusters > 0);
+
+    if (s->alloc_pool_remaining == 0) {
+        uint64_t n = MAX(*nb_clusters, s->alloc_pool_size);
+
+        offset = qcow2_alloc_clusters(bs, n << s->cluster_bits);
+        if (offset < 0) {
+            return offset;
+        }
+        s->alloc_pool_offset = offset;
+        s->alloc_pool_remaining = n;
+    }
+
+    *nb_clusters = MIN(*nb_clusters, s->alloc_pool_remaining);
+    offset = s->alloc_pool_offset;
+    s->alloc_pool_offset += *nb_clusters << s->cluster_bits;
+    s->alloc_pool_remaining -= *nb_clusters;
+
+    return offset;
+}
+
+/*
+ * Frees the clusters that are still left in the allocation pool.  Until
+ * this is done, they are accounted for in the refcounts without being
+ * referenced by anything, i.e. they look like leaked clusters.
+ */
+void qcow2_alloc_pool_release(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->alloc_pool_remaining == 0) {
+        return;
+    }
+
+    qcow2_free_clusters(bs, s->alloc_pool_offset,
+                        s->alloc_pool_remaining << s->cluster_bits,
+                        QCOW2_DISCARD_NEVER);
+    s->alloc_pool_remaining = 0;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
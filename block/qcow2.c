@@ -608,12 +608,16 @@ static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
                       BdrvCheckMode fix)
 {
+    BDRVQcow2State *s = bs->opaque;
     BdrvCheckResult snapshot_res = {};
     BdrvCheckResult refcount_res = {};
     int ret;
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would be reported as leaks */
+    qcow2_alloc_pool_release(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -622,6 +626,8 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     ret = qcow2_check_refcounts(bs, &refcount_res, fix);
     qcow2_add_check_result(result, &refcount_res, true);
+    /* Repairing may have rewritten L2 tables behind the cache's back */
+    qcow2_extent_cache_clear(s);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
         return ret;
@@ -701,6 +707,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_POOL_SIZE,
     NULL
 };
 
@@ -817,6 +824,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_POOL_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Amount of space to reserve at once for guest data "
+                    "clusters (0 = disabled)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -979,6 +992,7 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t alloc_pool_size; /* In clusters */
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1157,6 +1171,21 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->alloc_pool_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_POOL_SIZE, 0);
+    if (r->alloc_pool_size > QCOW2_MAX_ALLOC_POOL_SIZE) {
+        error_setg(errp, QCOW2_OPT_ALLOC_POOL_SIZE " must not exceed %"
+                   PRIu64 " bytes", (uint64_t) QCOW2_MAX_ALLOC_POOL_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (!QEMU_IS_ALIGNED(r->alloc_pool_size, s->cluster_size)) {
+        error_setg(errp, QCOW2_OPT_ALLOC_POOL_SIZE " must be a multiple of "
+                   "the cluster size");
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_pool_size >>= s->cluster_bits;
+
     switch (s->crypt_method_header) {
     case QCOW_CRYPT_NONE:
         if (encryptfmt) {
@@ -1229,6 +1258,7 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->l2_table_cache = r->l2_table_cache;
     s->refcount_block_cache = r->refcount_block_cache;
     s->l2_slice_size = r->l2_slice_size;
+    qcow2_extent_cache_clear(s);
 
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
@@ -1238,6 +1268,7 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
 
     s->discard_no_unref = r->discard_no_unref;
+    s->alloc_pool_size = r->alloc_pool_size;
 
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
@@ -1906,6 +1937,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    g_free(s->extents);
+    s->extents = NULL;
     cache_clean_timer_del(bs);
     if (s->l2_table_cache) {
         qcow2_cache_destroy(s->l2_table_cache);
@@ -2004,6 +2037,9 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
         goto fail;
     }
 
+    /* The pool size may change, and read-only images can't use the pool */
+    qcow2_alloc_pool_release(state->bs);
+
     /* We need to write out any unwritten data if we reopen read-only. */
     if ((state->flags & BDRV_O_RDWR) == 0) {
         ret = qcow2_reopen_bitmaps_ro(state->bs, errp);
@@ -2770,6 +2806,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_alloc_pool_release(bs);
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2798,6 +2836,8 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    g_free(s->extents);
+    s->extents = NULL;
 
     if (!(s->flags & BDRV_O_INACTIVE)) {
         qcow2_inactivate(bs);
@@ -4321,6 +4361,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Reserved clusters could keep the image file from being shrunk */
+    qcow2_alloc_pool_release(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4879,6 +4922,7 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
     if (ret < 0) {
         goto fail;
     }
+    qcow2_extent_cache_clear(s);
 
     ret = qcow2_cache_empty(bs, s->refcount_block_cache);
     if (ret < 0) {
@@ -5019,6 +5063,8 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    qcow2_alloc_pool_release(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
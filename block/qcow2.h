@@ -28,6 +28,7 @@
 #include "crypto/block.h"
 #include "qemu/coroutine.h"
 #include "qemu/units.h"
+#include "qemu/interval-tree.h"
 #include "block/block_int.h"
 
 //#define DEBUG_ALLOC
@@ -128,6 +129,9 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+/* Upper limit for the alloc-pool-size option */
+#define QCOW2_MAX_ALLOC_POOL_SIZE (1 * GiB)
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -150,6 +154,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_POOL_SIZE "alloc-pool-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -310,6 +315,21 @@ typedef struct Qcow2DiscardRegion {
     QTAILQ_ENTRY(Qcow2DiscardRegion) next;
 } Qcow2DiscardRegion;
 
+/* Maximum number of guest ranges remembered by the extent cache */
+#define QCOW2_MAX_EXTENTS 1024
+
+/* Clusters past the end of a read that are scanned to extend its extent */
+#define QCOW2_EXTENT_SCAN_AHEAD 64
+
+/*
+ * A range of guest offsets (node.start to node.last) that is stored in
+ * contiguous QCOW2_SUBCLUSTER_NORMAL subclusters starting at host_offset.
+ */
+typedef struct Qcow2Extent {
+    IntervalTreeNode node;
+    uint64_t host_offset;
+} Qcow2Extent;
+
 typedef uint64_t Qcow2GetRefcountFunc(const void *refcount_array,
                                       uint64_t index);
 typedef void Qcow2SetRefcountFunc(void *refcount_array,
@@ -346,6 +366,17 @@ typedef struct BDRVQcow2State {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
     QEMUTimer *cache_clean_timer;
+
+    /*
+     * Extent cache for the read path, built from the L2 tables.  Whoever
+     * changes L2 entries drops the extents of the affected guest range
+     * with qcow2_extent_cache_invalidate(); all fields are protected by
+     * lock.
+     */
+    Qcow2Extent *extents;
+    int nb_extents;
+    IntervalTreeRoot extent_root;
+
     unsigned cache_clean_interval;
 
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
@@ -401,6 +432,15 @@ typedef struct BDRVQcow2State {
     QTAILQ_HEAD (, Qcow2DiscardRegion) discards;
     bool cache_discards;
 
+    /*
+     * Clusters that have been allocated in one go, but not handed out for
+     * guest data yet (see qcow2_alloc_pool_get()).  alloc_pool_size is the
+     * number of clusters to reserve at a time, 0 disables the pool.
+     */
+    uint64_t alloc_pool_size;
+    uint64_t alloc_pool_offset;
+    uint64_t alloc_pool_remaining;
+
     /* Backing file path and format as stored in the image (this is not the
      * effective path/format, which may be the result of a runtime option
      * override) */
@@ -874,6 +914,9 @@ qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
+int64_t GRAPH_RDLOCK
+qcow2_alloc_pool_get(BlockDriverState *bs, uint64_t *nb_clusters);
+void GRAPH_RDLOCK qcow2_alloc_pool_release(BlockDriverState *bs);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
                                       enum qcow2_discard_type type);
@@ -924,6 +967,9 @@ int coroutine_fn GRAPH_RDLOCK
 qcow2_shrink_l1_table(BlockDriverState *bs, uint64_t max_size);
 
 int GRAPH_RDLOCK qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
+void qcow2_extent_cache_clear(BDRVQcow2State *s);
+void qcow2_extent_cache_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                   uint64_t bytes);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
@@ -236,6 +236,39 @@ static inline bool can_use_fpu(const float_status *s)
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+static bool force_soft_fma;
+
+/*
+ * Targets that clear the flags before each operation never satisfy
+ * can_use_fpu. For division and square root we can still use the host
+ * result when rounding to nearest-even: the rounding error of a correctly
+ * rounded quotient or root is exactly representable (unless the operands
+ * are tiny), so a fused multiply-add computing it tells us whether the
+ * result was inexact.
+ */
+static inline bool can_use_fpu_exact(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_rounding_mode == float_round_nearest_even &&
+                  !force_soft_fma);
+}
+
+/*
+ * The residual of a / b or sqrt(a) has roughly the exponent of a minus
+ * twice the mantissa width; keep it well above the subnormal range.
+ */
+static inline bool f32_residual_ok(union_float32 a)
+{
+    return fabsf(a.h) >= 0x1p-100f || a.h == 0;
+}
+
+static inline bool f64_residual_ok(union_float64 a)
+{
+    return fabs(a.h) >= 0x1p-900 || a.h == 0;
+}
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -2176,6 +2209,131 @@ float64_mul(float64 a, float64 b, float_status *s)
                         f64_is_zon2, f64_addsubmul_post);
 }
 
+/*
+ * Batched two-input operations, for guest vector helpers.
+ *
+ * Lanes are processed in chunks: the host operation is applied to the
+ * whole chunk in a loop the compiler can vectorize, and only if some lane
+ * has a special input or a result that needs softfloat (overflow, tiny or
+ * zero) is the chunk redone lane by lane through the scalar path. Results
+ * go through a temporary so that the destination may alias the inputs.
+ */
+#define SOFTFLOAT_VEC_CHUNK 16
+
+static inline void
+float32_gen2_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                 float_status *s, hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                 f32_check_fn pre, f32_check_fn post)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        union_float32 r[SOFTFLOAT_VEC_CHUNK];
+        bool special = !can_use_fpu(s);
+
+        len = MIN(n - i, SOFTFLOAT_VEC_CHUNK);
+        if (likely(!special)) {
+            for (j = 0; j < len; j++) {
+                union_float32 ua = { .s = a[i + j] };
+                union_float32 ub = { .s = b[i + j] };
+
+                r[j].h = hard(ua.h, ub.h);
+                special |= !pre(ua, ub) || f32_is_inf(r[j]) ||
+                           (fabsf(r[j].h) <= FLT_MIN && post(ua, ub));
+            }
+            if (likely(!special)) {
+                memcpy(&d[i], r, len * sizeof(float32));
+                continue;
+            }
+        }
+        for (j = 0; j < len; j++) {
+            d[i + j] = float32_gen2(a[i + j], b[i + j], s,
+                                    hard, soft, pre, post);
+        }
+    }
+}
+
+static inline void
+float64_gen2_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                 float_status *s, hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                 f64_check_fn pre, f64_check_fn post)
+{
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        union_float64 r[SOFTFLOAT_VEC_CHUNK];
+        bool special = !can_use_fpu(s);
+
+        len = MIN(n - i, SOFTFLOAT_VEC_CHUNK);
+        if (likely(!special)) {
+            for (j = 0; j < len; j++) {
+                union_float64 ua = { .s = a[i + j] };
+                union_float64 ub = { .s = b[i + j] };
+
+                r[j].h = hard(ua.h, ub.h);
+                special |= !pre(ua, ub) || f64_is_inf(r[j]) ||
+                           (fabs(r[j].h) <= DBL_MIN && post(ua, ub));
+            }
+            if (likely(!special)) {
+                memcpy(&d[i], r, len * sizeof(float64));
+                continue;
+            }
+        }
+        for (j = 0; j < len; j++) {
+            d[i + j] = float64_gen2(a[i + j], b[i + j], s,
+                                    hard, soft, pre, post);
+        }
+    }
+}
+
+void QEMU_FLATTEN
+float32_add_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s)
+{
+    float32_gen2_vec(n, d, a, b, s, hard_f32_add, soft_f32_add,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_sub_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s)
+{
+    float32_gen2_vec(n, d, a, b, s, hard_f32_sub, soft_f32_sub,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_mul_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s)
+{
+    float32_gen2_vec(n, d, a, b, s, hard_f32_mul, soft_f32_mul,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_add_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s)
+{
+    float64_gen2_vec(n, d, a, b, s, hard_f64_add, soft_f64_add,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_sub_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s)
+{
+    float64_gen2_vec(n, d, a, b, s, hard_f64_sub, soft_f64_sub,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_mul_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s)
+{
+    float64_gen2_vec(n, d, a, b, s, hard_f64_mul, soft_f64_mul,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
 float64 float64r32_mul(float64 a, float64 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
@@ -2277,8 +2435,6 @@ float64_muladd_scalbn(float64 a, float64 b, float64 c,
     return float64_round_pack_canonical(pr, status);
 }
 
-static bool force_soft_fma;
-
 float32 QEMU_FLATTEN
 float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
 {
@@ -2540,9 +2696,68 @@ static bool f64_div_post(union_float64 a, union_float64 b)
     return !float64_is_zero(a.s);
 }
 
+/*
+ * Division with the inexact flag clear on entry: compute the quotient on
+ * the host and derive inexact from the remainder a - q * b.
+ */
+static float32 float32_div_exact(float32 xa, float32 xb, float_status *s)
+{
+    union_float32 ua, ub, ur;
+
+    ua.s = xa;
+    ub.s = xb;
+
+    float32_input_flush2(&ua.s, &ub.s, s);
+    if (unlikely(!f32_div_pre(ua, ub) || !f32_residual_ok(ua))) {
+        goto soft;
+    }
+
+    ur.h = hard_f32_div(ua.h, ub.h);
+    if (unlikely(f32_is_inf(ur))) {
+        float_raise(float_flag_overflow | float_flag_inexact, s);
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && f32_div_post(ua, ub)) {
+        goto soft;
+    } else if (fmaf(ur.h, ub.h, -ua.h) != 0) {
+        float_raise(float_flag_inexact, s);
+    }
+    return ur.s;
+
+ soft:
+    return soft_f32_div(ua.s, ub.s, s);
+}
+
+static float64 float64_div_exact(float64 xa, float64 xb, float_status *s)
+{
+    union_float64 ua, ub, ur;
+
+    ua.s = xa;
+    ub.s = xb;
+
+    float64_input_flush2(&ua.s, &ub.s, s);
+    if (unlikely(!f64_div_pre(ua, ub) || !f64_residual_ok(ua))) {
+        goto soft;
+    }
+
+    ur.h = hard_f64_div(ua.h, ub.h);
+    if (unlikely(f64_is_inf(ur))) {
+        float_raise(float_flag_overflow | float_flag_inexact, s);
+    } else if (unlikely(fabs(ur.h) <= DBL_MIN) && f64_div_post(ua, ub)) {
+        goto soft;
+    } else if (fma(ur.h, ub.h, -ua.h) != 0) {
+        float_raise(float_flag_inexact, s);
+    }
+    return ur.s;
+
+ soft:
+    return soft_f64_div(ua.s, ub.s, s);
+}
+
 float32 QEMU_FLATTEN
 float32_div(float32 a, float32 b, float_status *s)
 {
+    if (unlikely(!can_use_fpu(s)) && can_use_fpu_exact(s)) {
+        return float32_div_exact(a, b, s);
+    }
     return float32_gen2(a, b, s, hard_f32_div, soft_f32_div,
                         f32_div_pre, f32_div_post);
 }
@@ -2550,6 +2765,9 @@ float32_div(float32 a, float32 b, float_status *s)
 float64 QEMU_FLATTEN
 float64_div(float64 a, float64 b, float_status *s)
 {
+    if (unlikely(!can_use_fpu(s)) && can_use_fpu_exact(s)) {
+        return float64_div_exact(a, b, s);
+    }
     return float64_gen2(a, b, s, hard_f64_div, soft_f64_div,
                         f64_div_pre, f64_div_post);
 }
@@ -4670,10 +4888,14 @@ soft_f64_sqrt(float64 a, float_status *status)
 float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
 {
     union_float32 ua, ur;
+    bool exact = false;
 
     ua.s = xa;
     if (unlikely(!can_use_fpu(s))) {
-        goto soft;
+        if (!can_use_fpu_exact(s)) {
+            goto soft;
+        }
+        exact = true;
     }
 
     float32_input_flush1(&ua.s, s);
@@ -4687,7 +4909,13 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
                         float32_is_neg(ua.s))) {
         goto soft;
     }
+    if (exact && unlikely(!f32_residual_ok(ua))) {
+        goto soft;
+    }
     ur.h = sqrtf(ua.h);
+    if (exact && fmaf(ur.h, ur.h, -ua.h) != 0) {
+        float_raise(float_flag_inexact, s);
+    }
     return ur.s;
 
  soft:
@@ -4697,10 +4925,14 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
 float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
 {
     union_float64 ua, ur;
+    bool exact = false;
 
     ua.s = xa;
     if (unlikely(!can_use_fpu(s))) {
-        goto soft;
+        if (!can_use_fpu_exact(s)) {
+            goto soft;
+        }
+        exact = true;
     }
 
     float64_input_flush1(&ua.s, s);
@@ -4714,7 +4946,13 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
                         float64_is_neg(ua.s))) {
         goto soft;
     }
+    if (exact && unlikely(!f64_residual_ok(ua))) {
+        goto soft;
+    }
     ur.h = sqrt(ua.h);
+    if (exact && fma(ur.h, ur.h, -ua.h) != 0) {
+        float_raise(float_flag_inexact, s);
+    }
     return ur.s;
 
  soft:
@@ -218,6 +218,7 @@ struct AioContext {
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     LuringState *linux_io_uring;
+    bool linux_io_uring_sqpoll; /* create linux_io_uring with SQPOLL */
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
@@ -517,6 +518,13 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/*
+ * Request kernel-side submission polling for the LuringState of this
+ * AioContext.  Only has an effect if called before aio_setup_linux_io_uring.
+ */
+void aio_context_set_io_uring_sqpoll(AioContext *ctx, bool sqpoll);
+
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -91,7 +91,8 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
-    struct tb_tc tc;
+    /* jmp_lock placed here to fill a 4-byte hole. Its documentation is below */
+    QemuSpin jmp_lock;
 
     /*
      * Track tb_page_addr_t intervals that intersect this TB.
@@ -100,16 +101,25 @@ struct TranslationBlock {
      * linked list headed in each PageDesc.  Within the list, the lsb
      * of the previous pointer tells the index of page_next[], and the
      * list is protected by the PageDesc lock(s).
+     *
+     * tcg_tb_alloc aligns TBs to the icache line size.  Everything up to
+     * and including @tc is kept within the first TB_LOOKUP_SIZE bytes, so
+     * that the comparison in tb_lookup_cmp and the code pointer returned
+     * on a hit share one host cache line; for user-only, the interval tree
+     * node does not leave room for @tc, but the start address still fits.
+     * Fields only needed when linking, invalidating or unwinding follow.
      */
 #ifdef CONFIG_USER_ONLY
     IntervalTreeNode itree;
 #else
-    uintptr_t page_next[2];
     tb_page_addr_t page_addr[2];
 #endif
 
-    /* jmp_lock placed here to fill a 4-byte hole. Its documentation is below */
-    QemuSpin jmp_lock;
+    struct tb_tc tc;
+
+#ifndef CONFIG_USER_ONLY
+    uintptr_t page_next[2];
+#endif
 
     /* The following data are used to directly call another TB from
      * the code of this one. This can be done either by emitting direct or
@@ -135,7 +145,9 @@ struct TranslationBlock {
      * can be acquired from any origin TB.
      *
      * jmp_dest[] are tagged pointers as well. The LSB is set when the TB is
-     * being invalidated, so that no further outgoing jumps from it can be set.
+     * being invalidated, so that no further outgoing jumps from it can be set;
+     * once the jump is removed from the destination's list, only the LSB
+     * is left.
      *
      * jmp_lock also protects the CF_INVALID cflag; a jump must not be chained
      * to a destination TB that has CF_INVALID set.
@@ -145,6 +157,18 @@ struct TranslationBlock {
     uintptr_t jmp_dest[2];
 };
 
+/*
+ * Size of the start of a TranslationBlock that holds the fields read by
+ * tb_lookup_cmp and the code pointer; the most common host cache line
+ * size.
+ */
+#define TB_LOOKUP_SIZE 64
+
+#ifndef CONFIG_USER_ONLY
+QEMU_BUILD_BUG_ON(offsetof(TranslationBlock, tc) + sizeof(struct tb_tc) >
+                  TB_LOOKUP_SIZE);
+#endif
+
 /* The alignment given to TranslationBlock during allocation. */
 #define CODE_GEN_ALIGN  16
 
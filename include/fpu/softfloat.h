@@ -598,6 +598,12 @@ float32 float32_round_to_int(float32, float_status *status);
 float32 float32_add(float32, float32, float_status *status);
 float32 float32_sub(float32, float32, float_status *status);
 float32 float32_mul(float32, float32, float_status *status);
+void float32_add_vec(size_t n, float32 *d, const float32 *a,
+                     const float32 *b, float_status *status);
+void float32_sub_vec(size_t n, float32 *d, const float32 *a,
+                     const float32 *b, float_status *status);
+void float32_mul_vec(size_t n, float32 *d, const float32 *a,
+                     const float32 *b, float_status *status);
 float32 float32_div(float32, float32, float_status *status);
 float32 float32_rem(float32, float32, float_status *status);
 float32 float32_muladd(float32, float32, float32, int, float_status *status);
@@ -795,6 +801,12 @@ float64 float64_round_to_int(float64, float_status *status);
 float64 float64_add(float64, float64, float_status *status);
 float64 float64_sub(float64, float64, float_status *status);
 float64 float64_mul(float64, float64, float_status *status);
+void float64_add_vec(size_t n, float64 *d, const float64 *a,
+                     const float64 *b, float_status *status);
+void float64_sub_vec(size_t n, float64 *d, const float64 *a,
+                     const float64 *b, float_status *status);
+void float64_mul_vec(size_t n, float64 *d, const float64 *a,
+                     const float64 *b, float_status *status);
 float64 float64_div(float64, float64, float_status *status);
 float64 float64_rem(float64, float64, float_status *status);
 float64 float64_muladd(float64, float64, float64, int, float_status *status);
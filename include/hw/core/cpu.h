@@ -199,8 +199,14 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
-#define CPU_VTLB_SIZE 8
+/*
+ * Use a set associative victim tlb of 8 sets of 4 ways.  The set is
+ * selected by the page number bits just above those used to index the
+ * main tlb, so that pages which conflict in the main tlb are spread out.
+ */
+#define CPU_VTLB_SETS 8
+#define CPU_VTLB_WAYS 4
+#define CPU_VTLB_SIZE (CPU_VTLB_SETS * CPU_VTLB_WAYS)
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -283,14 +289,28 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
+    /* The next way to use in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
+/*
+ * A page or range flush requested by another cpu, and not yet performed.
+ * The fields are as for tlb_flush_range_by_mmuidx.
+ */
+typedef struct CPUTLBPendingFlush {
+    vaddr addr;
+    vaddr len;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBPendingFlush;
+
+/* Beyond this many pending page or range flushes, flush the mmu_idx. */
+#define CPU_TLB_PENDING_SIZE 16
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -303,6 +323,17 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Flushes queued by tlb_flush_*_all_cpus_synced: pending_idxmap
+     * has a bit set for each mmu_idx to be flushed entirely, pending[]
+     * the individual page and range flushes, and pending_work records
+     * the kinds of work item queued to perform them.
+     * Protected by tlb_c.lock.
+     */
+    uint16_t pending_idxmap;
+    uint8_t pending_n;
+    uint8_t pending_work;
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_SIZE];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -311,6 +342,7 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t batch_flush_count;
 } CPUTLBCommon;
 
 /*
@@ -63,6 +63,7 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
+    qemu_plugin_vcpu_sample_cb_t     vcpu_sample;
     void *generic;
 };
 
@@ -72,6 +73,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_MEM_REGULAR,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
+    PLUGIN_CB_MEM_RING,
 };
 
 struct qemu_plugin_regular_cb {
@@ -96,6 +98,23 @@ struct qemu_plugin_conditional_cb {
     uint64_t imm;
 };
 
+/*
+ * Record the address of each access into a per-vcpu buffer: a uint64_t
+ * count at @entry, followed by @size uint64_t slots. Before the buffer
+ * can overflow, @f is called to drain it and the count is reset to zero.
+ * @reserve is the number of entries the instruction may append inline,
+ * which must fit in the buffer after the drain check at its start.
+ */
+struct qemu_plugin_ring_cb {
+    union qemu_plugin_cb_sig f;
+    TCGHelperInfo *info;
+    void *userp;
+    qemu_plugin_u64 entry;
+    uint64_t size;
+    uint64_t reserve;
+    enum qemu_plugin_mem_rw rw;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -107,6 +126,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_ring_cb ring;
     };
 };
 
@@ -142,9 +162,11 @@ struct qemu_plugin_tb {
 /**
  * struct CPUPluginState - per-CPU state for plugins
  * @event_mask: plugin event bitmap. Modified only via async work.
+ * @sample_pending: set by the sampler thread, cleared when sampled.
  */
 struct CPUPluginState {
     DECLARE_BITMAP(event_mask, QEMU_PLUGIN_EV_MAX);
+    bool sample_pending;
 };
 
 /**
@@ -165,6 +187,22 @@ qemu_plugin_vcpu_syscall(CPUState *cpu, int64_t num, uint64_t a1,
                          uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5,
                          uint64_t a6, uint64_t a7, uint64_t a8);
 void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
+void qemu_plugin_vcpu_sample_cb(CPUState *cpu, uint64_t pc);
+
+/**
+ * qemu_plugin_vcpu_sample(): take a pending sample
+ * @cpu: the vCPU about to execute a TB
+ * @pc: guest PC of that TB
+ *
+ * Called from the execution loop between TBs; cheap unless the sampler
+ * thread has asked for a sample of this vCPU.
+ */
+static inline void qemu_plugin_vcpu_sample(CPUState *cpu, uint64_t pc)
+{
+    if (unlikely(qatomic_read(&cpu->plugin_state->sample_pending))) {
+        qemu_plugin_vcpu_sample_cb(cpu, pc);
+    }
+}
 
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_low,
@@ -252,6 +290,9 @@ static inline
 void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret)
 { }
 
+static inline void qemu_plugin_vcpu_sample(CPUState *cpu, uint64_t pc)
+{ }
+
 static inline void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                                            uint64_t value_low,
                                            uint64_t value_high,
@@ -65,11 +65,15 @@ typedef uint64_t qemu_plugin_id_t;
  *
  * version 4:
  * - added qemu_plugin_read_memory_vaddr
+ *
+ * version 5:
+ * - added qemu_plugin_register_vcpu_mem_ring_per_vcpu
+ * - added qemu_plugin_register_vcpu_sample_cb
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 4
+#define QEMU_PLUGIN_VERSION 5
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -701,6 +705,35 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_ring_per_vcpu() - record mem accesses inline
+ * @insn: handle for instruction to instrument
+ * @rw: record reads, writes or both
+ * @entry: per-vcpu buffer, a uint64_t count followed by @size uint64_t slots
+ * @size: number of slots in the buffer
+ * @cb: callback called to drain the buffer
+ * @flags: does @cb read or write the CPU's registers?
+ * @userdata: any plugin data to pass to @cb
+ *
+ * This records the virtual address of every memory access generated by
+ * the instruction into the vCPU's buffer, without leaving the generated
+ * code. Before an instruction starts, @cb is called if the buffer does
+ * not have room for all the accesses the instruction may do; it should
+ * consume the number of addresses given by the count, after which the
+ * count is reset to zero. @size must therefore be at least the number
+ * of accesses of the instruction. Any addresses left when the plugin
+ * exits can be read from the scoreboard.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_ring_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    qemu_plugin_u64 entry,
+    size_t size,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    void *userdata);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
@@ -747,6 +780,40 @@ void
 qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
                                          qemu_plugin_vcpu_syscall_ret_cb_t cb);
 
+/**
+ * typedef qemu_plugin_vcpu_sample_cb_t - vcpu sampling callback
+ * @id: unique plugin id
+ * @vcpu_index: the sampled vCPU
+ * @pc: guest PC of the next translation block the vCPU executes
+ */
+typedef void (*qemu_plugin_vcpu_sample_cb_t)(qemu_plugin_id_t id,
+                                             unsigned int vcpu_index,
+                                             uint64_t pc);
+
+/**
+ * qemu_plugin_register_vcpu_sample_cb() - register a sampling callback
+ * @id: plugin ID
+ * @period_ns: sampling period in nanoseconds of host time
+ * @cb: callback function
+ *
+ * Every @period_ns, each running vCPU is asked to stop chaining
+ * translation blocks, and @cb is called from the vCPU thread with the
+ * PC of the block it is about to execute. No instrumentation is added to
+ * the generated code. The vCPU state can be inspected from @cb with
+ * qemu_plugin_read_register() and qemu_plugin_read_memory_vaddr(), e.g.
+ * to unwind the guest call stack.
+ *
+ * The period is rounded up to a whole number of milliseconds. If several
+ * plugins register a sampling callback, the shortest period requested is
+ * used for all of them. Sampling stops once every sampling callback has
+ * been unregistered, e.g. by passing a NULL @cb or uninstalling the
+ * plugin.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_sample_cb(qemu_plugin_id_t id,
+                                         uint64_t period_ns,
+                                         qemu_plugin_vcpu_sample_cb_t cb);
+
 
 /**
  * qemu_plugin_insn_disas() - return disassembly string for instruction
@@ -634,9 +634,12 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict(GTraverseFunc func, gpointer user_data);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
+size_t tcg_region_count(void);
+void tcg_region_usage(size_t *used, size_t *n_in_use, size_t *n_evicted);
 
 /**
  * tcg_tb_insert:
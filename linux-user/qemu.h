@@ -170,6 +170,8 @@ int do_guest_openat(CPUArchState *cpu_env, int dirfd, const char *pathname,
                     int flags, mode_t mode, bool safe);
 ssize_t do_guest_readlink(const char *pathname, char *buf, size_t bufsiz);
 
+extern __thread CPUState *thread_cpu;
+
 /* user access */
 
 #define VERIFY_NONE  0
@@ -334,7 +336,25 @@ int copy_struct_from_user(void *dst, size_t ksize, abi_ptr src, size_t usize);
 
 /* Lock an area of guest memory into the host.  If copy is true then the
    host area will have the same contents as the guest.  */
+#ifndef CONFIG_DEBUG_REMAP
+/*
+ * Without DEBUG_REMAP guest memory is used in place, so this is only the
+ * access check and address conversion; keep it inline since get_user and
+ * put_user use it for every scalar argument.  With DEBUG_REMAP the area
+ * is bounced through a g_malloc'd copy, which stays out of line.
+ */
+static inline void *lock_user(int type, abi_ulong guest_addr, ssize_t len,
+                              bool copy)
+{
+    guest_addr = cpu_untagged_addr(thread_cpu, guest_addr);
+    if (!access_ok_untagged(type, guest_addr, len)) {
+        return NULL;
+    }
+    return g2h_untagged(guest_addr);
+}
+#else
 void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy);
+#endif
 
 /* Unlock an area of guest memory.  The first LEN bytes must be
    flushed back to guest memory. host_ptr = NULL is explicitly
@@ -5,6 +5,7 @@
 #include "qemu.h"
 #include "user-internals.h"
 
+#ifdef CONFIG_DEBUG_REMAP
 void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy)
 {
     void *host_addr;
@@ -14,17 +15,14 @@ void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy)
         return NULL;
     }
     host_addr = g2h_untagged(guest_addr);
-#ifdef CONFIG_DEBUG_REMAP
     if (copy) {
         host_addr = g_memdup(host_addr, len);
     } else {
         host_addr = g_malloc0(len);
     }
-#endif
     return host_addr;
 }
 
-#ifdef CONFIG_DEBUG_REMAP
 void unlock_user(void *host_ptr, abi_ulong guest_addr, ssize_t len)
 {
     void *host_ptr_conv;
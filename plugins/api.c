@@ -188,6 +188,22 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     plugin_register_inline_op_on_entry(&insn->mem_cbs, rw, op, entry, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_ring_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    qemu_plugin_u64 entry,
+    size_t size,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    void *udata)
+{
+    g_assert(size > 0);
+    g_assert(entry.offset + (size + 1) * sizeof(uint64_t) <=
+             g_array_get_element_size(entry.score->data));
+    plugin_register_vcpu_mem_ring_cb(&insn->mem_cbs, cb, flags, rw,
+                                     entry, size, udata);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -18,6 +18,9 @@
 #include "qemu/queue.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "exec/cpu-common.h"
 #include "exec/tb-flush.h"
 #include "tcg/tcg-op-common.h"
 #include "plugin.h"
@@ -60,6 +63,57 @@ static void plugin_cpu_update__locked(gpointer k, gpointer v, gpointer udata)
     async_run_on_cpu(cpu, plugin_cpu_update__async, mask);
 }
 
+/*
+ * Periodically flag every vCPU for sampling and make it leave the chain
+ * of TBs it is executing, so that the execution loop gets to see it.
+ *
+ * CPUs are freed without waiting for an RCU grace period, so walk the
+ * list under qemu_cpu_list_lock: a CPU is removed from the list before
+ * it is finalized.  Never block on the lock, though, since it is held
+ * around fork() together with plugin.lock, under which we are joined;
+ * a sample is simply skipped if the list is busy.
+ */
+static void *plugin_sampler_thread(void *opaque)
+{
+    while (true) {
+        uint64_t period_ns = qatomic_read(&plugin.sample_period_ns);
+        CPUState *cpu;
+
+        if (qemu_sem_timedwait(&plugin.sampler_stop,
+                               DIV_ROUND_UP(period_ns, SCALE_MS)) == 0) {
+            break;
+        }
+        if (qemu_mutex_trylock(&qemu_cpu_list_lock)) {
+            continue;
+        }
+        CPU_FOREACH(cpu) {
+            if (cpu->plugin_state) {
+                qatomic_set(&cpu->plugin_state->sample_pending, true);
+                qatomic_set(&cpu->neg.icount_decr.u16.high, -1);
+            }
+        }
+        qemu_mutex_unlock(&qemu_cpu_list_lock);
+    }
+
+    return NULL;
+}
+
+static void plugin_sampler_start__locked(void)
+{
+    qemu_sem_init(&plugin.sampler_stop, 0);
+    qemu_thread_create(&plugin.sampler, "plugin-sampler",
+                       plugin_sampler_thread, NULL, QEMU_THREAD_JOINABLE);
+}
+
+/* Called when the last sampling callback goes away */
+static void plugin_sampler_stop__locked(void)
+{
+    qemu_sem_post(&plugin.sampler_stop);
+    qemu_thread_join(&plugin.sampler);
+    qemu_sem_destroy(&plugin.sampler_stop);
+    plugin.sample_period_ns = 0;
+}
+
 void plugin_unregister_cb__locked(struct qemu_plugin_ctx *ctx,
                                   enum qemu_plugin_event ev)
 {
@@ -74,6 +128,9 @@ void plugin_unregister_cb__locked(struct qemu_plugin_ctx *ctx,
     if (QLIST_EMPTY_RCU(&plugin.cb_lists[ev])) {
         clear_bit(ev, plugin.mask);
         g_hash_table_foreach(plugin.cpu_ht, plugin_cpu_update__locked, NULL);
+        if (ev == QEMU_PLUGIN_EV_VCPU_SAMPLE) {
+            plugin_sampler_stop__locked();
+        }
     }
 }
 
@@ -457,6 +514,38 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->regular = regular_cb;
 }
 
+void plugin_register_vcpu_mem_ring_cb(GArray **arr,
+                                      qemu_plugin_vcpu_udata_cb_t cb,
+                                      enum qemu_plugin_cb_flags flags,
+                                      enum qemu_plugin_mem_rw rw,
+                                      qemu_plugin_u64 entry,
+                                      uint64_t size,
+                                      void *udata)
+{
+    static TCGHelperInfo info[3] = {
+        [QEMU_PLUGIN_CB_NO_REGS].flags = TCG_CALL_NO_RWG,
+        [QEMU_PLUGIN_CB_R_REGS].flags = TCG_CALL_NO_WG,
+        /*
+         * Match qemu_plugin_vcpu_udata_cb_t:
+         *   void (*)(uint32_t, void *)
+         */
+        [0 ... 2].typemask = (dh_typemask(void, 0) |
+                              dh_typemask(i32, 1) |
+                              dh_typemask(ptr, 2))
+    };
+    assert((unsigned)flags < ARRAY_SIZE(info));
+
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+    struct qemu_plugin_ring_cb ring_cb = { .userp = udata,
+                                           .f.vcpu_udata = cb,
+                                           .rw = rw,
+                                           .entry = entry,
+                                           .size = size,
+                                           .info = &info[flags] };
+    dyn_cb->type = PLUGIN_CB_MEM_RING;
+    dyn_cb->ring = ring_cb;
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -524,6 +613,48 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret)
     }
 }
 
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void qemu_plugin_vcpu_sample_cb(CPUState *cpu, uint64_t pc)
+{
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_SAMPLE;
+
+    qatomic_set(&cpu->plugin_state->sample_pending, false);
+    if (!test_bit(ev, cpu->plugin_state->event_mask)) {
+        return;
+    }
+
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        qemu_plugin_vcpu_sample_cb_t func = cb->f.vcpu_sample;
+
+        func(cb->ctx->id, cpu->cpu_index, pc);
+    }
+}
+
+void qemu_plugin_register_vcpu_sample_cb(qemu_plugin_id_t id,
+                                         uint64_t period_ns,
+                                         qemu_plugin_vcpu_sample_cb_t cb)
+{
+    g_assert(period_ns > 0);
+    plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_SAMPLE, cb);
+    if (cb == NULL) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    if (!plugin.sample_period_ns) {
+        qatomic_set(&plugin.sample_period_ns, period_ns);
+        plugin_sampler_start__locked();
+    } else if (period_ns < plugin.sample_period_ns) {
+        qatomic_set(&plugin.sample_period_ns, period_ns);
+    }
+}
+
 void qemu_plugin_vcpu_idle_cb(CPUState *cpu)
 {
     /* idle and resume cb may be called before init, ignore in this case */
@@ -593,6 +724,31 @@ void exec_inline_op(enum plugin_dyn_cb_type type,
     }
 }
 
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+static void exec_ring_op(struct qemu_plugin_ring_cb *cb,
+                         int cpu_index, uint64_t vaddr)
+{
+    char *ptr = cb->entry.score->data->data;
+    size_t elem_size = g_array_get_element_size(
+        cb->entry.score->data);
+    size_t offset = cb->entry.offset;
+    uint64_t *count = (uint64_t *)(ptr + offset + cpu_index * elem_size);
+
+    count[1 + MIN(*count, cb->size - 1)] = vaddr;
+    *count = MIN(*count + 1, cb->size);
+
+    /* Leave room for the accesses the instruction does inline */
+    if (*count + cb->reserve >= cb->size) {
+        cb->f.vcpu_udata(cpu_index, cb->userp);
+        *count = 0;
+    }
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_low,
                              uint64_t value_high,
@@ -626,6 +782,11 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                 exec_inline_op(cb->type, &cb->inline_insn, cpu->cpu_index);
             }
             break;
+        case PLUGIN_CB_MEM_RING:
+            if (rw & cb->ring.rw) {
+                exec_ring_op(&cb->ring, cpu->cpu_index, vaddr);
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -704,6 +865,10 @@ void qemu_plugin_user_postfork(bool is_child)
     if (is_child) {
         /* should we just reset via plugin_init? */
         qemu_rec_mutex_init(&plugin.lock);
+        /* only the forking thread survives in the child */
+        if (plugin.sample_period_ns) {
+            plugin_sampler_start__locked();
+        }
     } else {
         qemu_rec_mutex_unlock(&plugin.lock);
     }
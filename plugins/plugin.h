@@ -49,6 +49,13 @@ struct qemu_plugin_state {
     struct qht dyn_cb_arr_ht;
     /* How many vcpus were started */
     int num_vcpus;
+    /*
+     * Sampling period, zero when there is no sampling callback, and the
+     * thread requesting the samples
+     */
+    uint64_t sample_period_ns;
+    QemuThread sampler;
+    QemuSemaphore sampler_stop;
 };
 
 
@@ -109,6 +116,14 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
+void plugin_register_vcpu_mem_ring_cb(GArray **arr,
+                                      qemu_plugin_vcpu_udata_cb_t cb,
+                                      enum qemu_plugin_cb_flags flags,
+                                      enum qemu_plugin_mem_rw rw,
+                                      qemu_plugin_u64 entry,
+                                      uint64_t size,
+                                      void *udata);
+
 void exec_inline_op(enum plugin_dyn_cb_type type,
                     struct qemu_plugin_inline_cb *cb,
                     int cpu_index);
@@ -1503,6 +1503,14 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``alloc-pool-size``
+            Amount of space in bytes that is reserved at once for new
+            guest data clusters, so that refcounts need not be updated
+            for every allocating write. It must be a multiple of the
+            cluster size. Reserved clusters that are not used yet when
+            QEMU crashes are leaked. The default value is 0, which
+            disables this feature.
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
@@ -46,6 +46,12 @@ typedef struct MemCopyInfo {
     TCGType type;
 } MemCopyInfo;
 
+typedef struct MemStoreInfo {
+    IntervalTreeNode itree;
+    QSIMPLEQ_ENTRY (MemStoreInfo) next;
+    TCGOp *op;
+} MemStoreInfo;
+
 typedef struct TempOptInfo {
     bool is_const;
     TCGTemp *prev_copy;
@@ -64,6 +70,10 @@ typedef struct OptContext {
     IntervalTreeRoot mem_copy;
     QSIMPLEQ_HEAD(, MemCopyInfo) mem_free;
 
+    /* Stores to env which have not yet been observed. */
+    IntervalTreeRoot mem_store;
+    QSIMPLEQ_HEAD(, MemStoreInfo) mem_store_free;
+
     /* In flight values from optimization. */
     TCGType type;
 } OptContext;
@@ -194,6 +204,77 @@ static void remove_mem_copy_all(OptContext *ctx)
     tcg_debug_assert(interval_tree_is_empty(&ctx->mem_copy));
 }
 
+static MemStoreInfo *mem_store_first(OptContext *ctx, intptr_t s, intptr_t l)
+{
+    IntervalTreeNode *r = interval_tree_iter_first(&ctx->mem_store, s, l);
+    return r ? container_of(r, MemStoreInfo, itree) : NULL;
+}
+
+static MemStoreInfo *mem_store_next(MemStoreInfo *ms, intptr_t s, intptr_t l)
+{
+    IntervalTreeNode *r = interval_tree_iter_next(&ms->itree, s, l);
+    return r ? container_of(r, MemStoreInfo, itree) : NULL;
+}
+
+static void remove_mem_store(OptContext *ctx, MemStoreInfo *ms)
+{
+    interval_tree_remove(&ms->itree, &ctx->mem_store);
+    QSIMPLEQ_INSERT_TAIL(&ctx->mem_store_free, ms, next);
+}
+
+/*
+ * The bytes [s, l] of env may be read: the stores which
+ * overlap the range are no longer candidates for removal.
+ */
+static void remove_mem_store_in(OptContext *ctx, intptr_t s, intptr_t l)
+{
+    while (true) {
+        MemStoreInfo *ms = mem_store_first(ctx, s, l);
+        if (!ms) {
+            break;
+        }
+        remove_mem_store(ctx, ms);
+    }
+}
+
+static void remove_mem_store_all(OptContext *ctx)
+{
+    remove_mem_store_in(ctx, 0, -1);
+    tcg_debug_assert(interval_tree_is_empty(&ctx->mem_store));
+}
+
+/*
+ * Record OP as a store to the bytes [start, last] of env.
+ * Any previous store whose bytes are all overwritten by OP,
+ * without having been read in between, is dead and is removed.
+ */
+static void record_mem_store(OptContext *ctx, TCGOp *op,
+                             intptr_t start, intptr_t last)
+{
+    MemStoreInfo *ms, *next;
+
+    for (ms = mem_store_first(ctx, start, last); ms; ms = next) {
+        next = mem_store_next(ms, start, last);
+        if (ms->itree.start >= start && ms->itree.last <= last) {
+            tcg_op_remove(ctx->tcg, ms->op);
+            remove_mem_store(ctx, ms);
+        }
+    }
+
+    ms = QSIMPLEQ_FIRST(&ctx->mem_store_free);
+    if (ms) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->mem_store_free, next);
+    } else {
+        ms = tcg_malloc(sizeof(*ms));
+    }
+
+    memset(ms, 0, sizeof(*ms));
+    ms->itree.start = start;
+    ms->itree.last = last;
+    ms->op = op;
+    interval_tree_insert(&ms->itree, &ctx->mem_store);
+}
+
 static TCGTemp *find_better_copy(TCGTemp *ts)
 {
     TCGTemp *i, *ret;
@@ -822,6 +903,107 @@ static int do_constant_folding_cond1(OptContext *ctx, TCGOp *op, TCGArg dest,
     return -1;
 }
 
+/*
+ * Return the op which last defined ARG before USE, searching backward
+ * within the basic block and following moves, provided that none of the
+ * inputs of that op have been modified by it or between it and USE.
+ */
+static TCGOp *find_unmodified_def(TCGOp *use, TCGArg arg)
+{
+    TCGTemp *ts = arg_temp(arg);
+    TCGOp *op, *def = NULL;
+    const TCGOpDef *dd;
+    int limit = 32;
+
+    for (op = QTAILQ_PREV(use, link); op && !def; op = QTAILQ_PREV(op, link)) {
+        const TCGOpDef *d;
+
+        if (op->opc == INDEX_op_call || --limit < 0) {
+            return NULL;
+        }
+        d = &tcg_op_defs[op->opc];
+        if (d->flags & TCG_OPF_BB_END) {
+            return NULL;
+        }
+        for (int i = 0; i < d->nb_oargs; i++) {
+            if (arg_temp(op->args[i]) != ts) {
+                continue;
+            }
+            if (op->opc == INDEX_op_mov_i32 || op->opc == INDEX_op_mov_i64) {
+                ts = arg_temp(op->args[1]);
+            } else {
+                def = op;
+            }
+            break;
+        }
+    }
+    if (!def) {
+        return NULL;
+    }
+
+    dd = &tcg_op_defs[def->opc];
+    /* Start with DEF itself, which may overwrite one of its own inputs. */
+    for (op = def; op != use; op = QTAILQ_NEXT(op, link)) {
+        const TCGOpDef *d = &tcg_op_defs[op->opc];
+
+        for (int i = 0; i < d->nb_oargs; i++) {
+            TCGTemp *out = arg_temp(op->args[i]);
+
+            for (int j = dd->nb_oargs; j < dd->nb_oargs + dd->nb_iargs; j++) {
+                if (out == arg_temp(def->args[j])) {
+                    return NULL;
+                }
+            }
+        }
+    }
+    return def;
+}
+
+/*
+ * Front ends materialize condition flags with setcond, or as the
+ * difference of the compared values, and later test the flag against
+ * zero.  If the operands of the flag computation are still available,
+ * compare them directly, so that the flag computation may become dead.
+ * Return as for do_constant_folding_cond1.
+ */
+static int fold_cond_of_flag(OptContext *ctx, TCGOp *op, TCGArg dest,
+                             TCGArg *p1, TCGArg *p2, TCGArg *pcond)
+{
+    TCGCond cond = *pcond;
+    TCGOp *def;
+
+    if ((cond != TCG_COND_EQ && cond != TCG_COND_NE)
+        || !arg_is_const_val(*p2, 0)) {
+        return -1;
+    }
+    def = find_unmodified_def(op, *p1);
+    if (!def || TCGOP_TYPE(def) != ctx->type) {
+        return -1;
+    }
+
+    switch (def->opc) {
+    CASE_OP_32_64(sub):
+    CASE_OP_32_64(xor):
+        /* x - y == 0 and x ^ y == 0 iff x == y. */
+        break;
+    CASE_OP_32_64(setcond):
+    CASE_OP_32_64(negsetcond):
+        if (cond == TCG_COND_NE) {
+            cond = def->args[3];
+        } else {
+            cond = tcg_invert_cond(def->args[3]);
+        }
+        break;
+    default:
+        return -1;
+    }
+
+    *p1 = def->args[1];
+    *p2 = def->args[2];
+    *pcond = cond;
+    return do_constant_folding_cond1(ctx, op, dest, p1, p2, pcond);
+}
+
 static int do_constant_folding_cond2(OptContext *ctx, TCGOp *op, TCGArg *args)
 {
     TCGArg al, ah, bl, bh;
@@ -944,6 +1126,8 @@ static void finish_bb(OptContext *ctx)
 {
     /* We only optimize memory barriers across basic blocks. */
     ctx->prev_mb = NULL;
+    /* The stores may be read on the other side of the branch. */
+    remove_mem_store_all(ctx);
 }
 
 static void finish_ebb(OptContext *ctx)
@@ -1423,6 +1607,10 @@ static bool fold_brcond(OptContext *ctx, TCGOp *op)
 {
     int i = do_constant_folding_cond1(ctx, op, NO_DEST, &op->args[0],
                                       &op->args[1], &op->args[2]);
+    if (i < 0) {
+        i = fold_cond_of_flag(ctx, op, NO_DEST, &op->args[0],
+                              &op->args[1], &op->args[2]);
+    }
     if (i == 0) {
         tcg_op_remove(ctx->tcg, op);
         return true;
@@ -1613,6 +1801,9 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
         remove_mem_copy_all(ctx);
     }
 
+    /* Any helper may read env through its arguments. */
+    remove_mem_store_all(ctx);
+
     /* Reset temp data for outputs. */
     for (i = 0; i < nb_oargs; i++) {
         reset_temp(ctx, op->args[i]);
@@ -1800,6 +1991,18 @@ static bool fold_dup2(OptContext *ctx, TCGOp *op)
     return finish_folding(ctx, op);
 }
 
+static bool fold_dupm(OptContext *ctx, TCGOp *op)
+{
+    intptr_t ofs = op->args[2];
+
+    if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        remove_mem_store_all(ctx);
+    } else {
+        remove_mem_store_in(ctx, ofs, ofs + (1 << TCGOP_VECE(op)) - 1);
+    }
+    return finish_folding(ctx, op);
+}
+
 static bool fold_eqv(OptContext *ctx, TCGOp *op)
 {
     uint64_t s_mask;
@@ -2207,6 +2410,8 @@ static bool fold_qemu_ld_1reg(OptContext *ctx, TCGOp *op)
 
     /* Opcodes that touch guest memory stop the mb optimization.  */
     ctx->prev_mb = NULL;
+    /* A fault unwinds to the exception path, which reads env. */
+    remove_mem_store_all(ctx);
 
     return fold_masks_zs(ctx, op, z_mask, s_mask);
 }
@@ -2215,6 +2420,8 @@ static bool fold_qemu_ld_2reg(OptContext *ctx, TCGOp *op)
 {
     /* Opcodes that touch guest memory stop the mb optimization.  */
     ctx->prev_mb = NULL;
+    /* A fault unwinds to the exception path, which reads env. */
+    remove_mem_store_all(ctx);
     return finish_folding(ctx, op);
 }
 
@@ -2222,6 +2429,8 @@ static bool fold_qemu_st(OptContext *ctx, TCGOp *op)
 {
     /* Opcodes that touch guest memory stop the mb optimization.  */
     ctx->prev_mb = NULL;
+    /* A fault unwinds to the exception path, which reads env. */
+    remove_mem_store_all(ctx);
     return true;
 }
 
@@ -2438,6 +2647,10 @@ static bool fold_setcond(OptContext *ctx, TCGOp *op)
 {
     int i = do_constant_folding_cond1(ctx, op, op->args[0], &op->args[1],
                                       &op->args[2], &op->args[3]);
+    if (i < 0) {
+        i = fold_cond_of_flag(ctx, op, op->args[0], &op->args[1],
+                              &op->args[2], &op->args[3]);
+    }
     if (i >= 0) {
         return tcg_opt_gen_movi(ctx, op, op->args[0], i);
     }
@@ -2457,6 +2670,10 @@ static bool fold_negsetcond(OptContext *ctx, TCGOp *op)
 {
     int i = do_constant_folding_cond1(ctx, op, op->args[0], &op->args[1],
                                       &op->args[2], &op->args[3]);
+    if (i < 0) {
+        i = fold_cond_of_flag(ctx, op, op->args[0], &op->args[1],
+                              &op->args[2], &op->args[3]);
+    }
     if (i >= 0) {
         return tcg_opt_gen_movi(ctx, op, op->args[0], -i);
     }
@@ -2557,6 +2774,25 @@ static bool fold_setcond2(OptContext *ctx, TCGOp *op)
     return tcg_opt_gen_movi(ctx, op, op->args[0], i);
 }
 
+static bool fold_set_label(OptContext *ctx, TCGOp *op)
+{
+    TCGLabel *label = arg_label(op->args[0]);
+
+    /*
+     * If all branches to the label have been folded away, the label
+     * can only be reached by falling through from the previous op.
+     * Everything we know about temps and memory is still valid, so
+     * keep optimizing across it.  The label itself will be removed
+     * by reachable_code_pass, before liveness sees any temp that we
+     * have propagated past it.
+     */
+    if (QSIMPLEQ_EMPTY(&label->branches)) {
+        return true;
+    }
+    finish_ebb(ctx);
+    return true;
+}
+
 static bool fold_sextract(OptContext *ctx, TCGOp *op)
 {
     uint64_t z_mask, s_mask, s_mask_old;
@@ -2704,53 +2940,71 @@ static bool fold_sub2(OptContext *ctx, TCGOp *op)
 static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
 {
     uint64_t z_mask = -1, s_mask = 0;
+    intptr_t lm1;
 
     /* We can't do any folding with a load, but we can record bits. */
     switch (op->opc) {
     CASE_OP_32_64(ld8s):
         s_mask = INT8_MIN;
+        lm1 = 0;
         break;
     CASE_OP_32_64(ld8u):
         z_mask = MAKE_64BIT_MASK(0, 8);
+        lm1 = 0;
         break;
     CASE_OP_32_64(ld16s):
         s_mask = INT16_MIN;
+        lm1 = 1;
         break;
     CASE_OP_32_64(ld16u):
         z_mask = MAKE_64BIT_MASK(0, 16);
+        lm1 = 1;
         break;
     case INDEX_op_ld32s_i64:
         s_mask = INT32_MIN;
+        lm1 = 3;
         break;
     case INDEX_op_ld32u_i64:
         z_mask = MAKE_64BIT_MASK(0, 32);
+        lm1 = 3;
         break;
     default:
         g_assert_not_reached();
     }
+
+    if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        remove_mem_store_all(ctx);
+    } else {
+        remove_mem_store_in(ctx, op->args[2], op->args[2] + lm1);
+    }
     return fold_masks_zs(ctx, op, z_mask, s_mask);
 }
 
 static bool fold_tcg_ld_memcopy(OptContext *ctx, TCGOp *op)
 {
     TCGTemp *dst, *src;
-    intptr_t ofs;
+    intptr_t ofs, last;
     TCGType type;
 
     if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        /* The pointer may alias env. */
+        remove_mem_store_all(ctx);
         return finish_folding(ctx, op);
     }
 
     type = ctx->type;
     ofs = op->args[2];
+    last = ofs + tcg_type_size(type) - 1;
     dst = arg_temp(op->args[0]);
     src = find_mem_copy_for(ctx, type, ofs);
     if (src && src->base_type == type) {
+        /* Forwarded from a temp, the load no longer reads env. */
         return tcg_opt_gen_mov(ctx, op, temp_arg(dst), temp_arg(src));
     }
 
+    remove_mem_store_in(ctx, ofs, last);
     reset_ts(ctx, dst);
-    record_mem_copy(ctx, type, dst, ofs, ofs + tcg_type_size(type) - 1);
+    record_mem_copy(ctx, type, dst, ofs, last);
     return true;
 }
 
@@ -2785,6 +3039,7 @@ static bool fold_tcg_st(OptContext *ctx, TCGOp *op)
         g_assert_not_reached();
     }
     remove_mem_copy_in(ctx, ofs, ofs + lm1);
+    record_mem_store(ctx, op, ofs, ofs + lm1);
     return true;
 }
 
@@ -2817,6 +3072,7 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
     last = ofs + tcg_type_size(type) - 1;
     remove_mem_copy_in(ctx, ofs, last);
     record_mem_copy(ctx, type, src, ofs, last);
+    record_mem_store(ctx, op, ofs, last);
     return true;
 }
 
@@ -2847,6 +3103,7 @@ void tcg_optimize(TCGContext *s)
     OptContext ctx = { .tcg = s };
 
     QSIMPLEQ_INIT(&ctx.mem_free);
+    QSIMPLEQ_INIT(&ctx.mem_store_free);
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -2927,6 +3184,9 @@ void tcg_optimize(TCGContext *s)
         case INDEX_op_dup2_vec:
             done = fold_dup2(&ctx, op);
             break;
+        case INDEX_op_dupm_vec:
+            done = fold_dupm(&ctx, op);
+            break;
         CASE_OP_32_64_VEC(eqv):
             done = fold_eqv(&ctx, op);
             break;
@@ -3074,6 +3334,8 @@ void tcg_optimize(TCGContext *s)
             done = fold_xor(&ctx, op);
             break;
         case INDEX_op_set_label:
+            done = fold_set_label(&ctx, op);
+            break;
         case INDEX_op_br:
         case INDEX_op_exit_tb:
         case INDEX_op_goto_tb:
@@ -29,6 +29,7 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
@@ -72,6 +73,10 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t gen; /* number of region allocations since the last reset */
+    uint64_t *alloc_gen; /* .gen at allocation of each region; 0 if free */
+    size_t *evicted; /* stack of regions freed by tcg_region_evict */
+    size_t n_evicted;
 };
 
 static struct tcg_region_state region;
@@ -191,10 +196,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* @p must be within the rw view of code_gen_buffer. */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -205,19 +223,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -359,11 +365,17 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.n_evicted) {
+        curr_region = region.evicted[--region.n_evicted];
+    } else if (region.current < region.n) {
+        curr_region = region.current++;
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    region.alloc_gen[curr_region] = ++region.gen;
+    tcg_region_assign(s, curr_region);
     return false;
 }
 
@@ -412,6 +424,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.gen = 0;
+    region.n_evicted = 0;
+    memset(region.alloc_gen, 0, region.n * sizeof(*region.alloc_gen));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,6 +437,63 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Call from a safe-work context.
+ *
+ * Free the least recently allocated region which is not in use by any
+ * TCGContext, first passing each of its TBs to @func so that the caller
+ * can unlink them from the rest of the system.  This allows the code
+ * cache to be recycled a region at a time instead of all at once.
+ * Returns false if there is no such region, in which case the caller
+ * must fall back to tcg_region_reset_all.
+ */
+bool tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree unsigned long *in_use = bitmap_new(region.n);
+    uint64_t victim_gen = UINT64_MAX;
+    size_t victim = region.n;
+    struct tcg_region_tree *rt;
+    void *start, *end;
+    unsigned int i;
+
+    qemu_mutex_lock(&region.lock);
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        set_bit(tcg_region_index(s->code_gen_buffer), in_use);
+    }
+
+    for (i = 0; i < region.n; i++) {
+        uint64_t gen = region.alloc_gen[i];
+
+        if (gen && gen < victim_gen && !test_bit(i, in_use)) {
+            victim = i;
+            victim_gen = gen;
+        }
+    }
+    if (victim == region.n) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+
+    /* The region was accounted as full when its context moved on. */
+    tcg_region_bounds(victim, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    region.alloc_gen[victim] = 0;
+    region.evicted[region.n_evicted++] = victim;
+    qemu_mutex_unlock(&region.lock);
+
+    rt = region_trees + victim * tree_size;
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+    return true;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -851,6 +923,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     }
 
     tcg_region_trees_init();
+    region.alloc_gen = g_new0(uint64_t, region.n);
+    region.evicted = g_new(size_t, region.n);
 
     /*
      * Leave the initial context initialized to the first region.
@@ -902,6 +976,52 @@ size_t tcg_code_size(void)
     return total;
 }
 
+/*
+ * Returns the number of regions the code cache is divided into.
+ * See also: tcg_region_usage()
+ */
+size_t tcg_region_count(void)
+{
+    /* no need for synchronization; set at init time */
+    return region.n;
+}
+
+/*
+ * Fill @used, an array of tcg_region_count() elements, with the size (in
+ * bytes) of the translated code in each region.  Like tcg_code_size(),
+ * regions that their context has moved on from count as full.
+ * Also return the number of regions that hold code in *@n_in_use, and
+ * the number of regions freed by tcg_region_evict() and not reused yet
+ * in *@n_evicted.
+ */
+void tcg_region_usage(size_t *used, size_t *n_in_use, size_t *n_evicted)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int i;
+
+    qemu_mutex_lock(&region.lock);
+    *n_in_use = 0;
+    for (i = 0; i < region.n; i++) {
+        void *start, *end;
+
+        if (region.alloc_gen[i]) {
+            tcg_region_bounds(i, &start, &end);
+            used[i] = end - start - TCG_HIGHWATER;
+            (*n_in_use)++;
+        } else {
+            used[i] = 0;
+        }
+    }
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        used[tcg_region_index(s->code_gen_buffer)] =
+            qatomic_read(&s->code_gen_ptr) - s->code_gen_buffer;
+    }
+    *n_evicted = region.n_evicted;
+    qemu_mutex_unlock(&region.lock);
+}
+
 /*
  * Returns the code capacity (in bytes) of the entire cache, i.e. including all
  * regions.
@@ -3665,14 +3665,67 @@ static void la_global_sync(TCGContext *s, int ng)
     }
 }
 
+/*
+ * liveness analysis: at a label, record the direct globals which are
+ * dead: on every path from the label they are overwritten before they
+ * are read or required to be in memory.  Return NULL if there are none.
+ */
+static unsigned long *la_label_dead_globals(TCGContext *s, int ng)
+{
+    unsigned long *dead = NULL;
+
+    for (int i = 0; i < ng; ++i) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->kind == TEMP_GLOBAL && !ts->indirect_reg
+            && ts->state == TS_DEAD) {
+            if (!dead) {
+                size_t size = BITS_TO_LONGS(ng) * sizeof(unsigned long);
+                dead = tcg_malloc(size);
+                memset(dead, 0, size);
+            }
+            set_bit(i, dead);
+        }
+    }
+    return dead;
+}
+
+/*
+ * liveness analysis: branch or fall through to a label: globals which
+ * are dead at the label need not be in memory.
+ */
+static void la_label_kill(TCGContext *s, int ng, const unsigned long *dead)
+{
+    if (dead) {
+        for (int i = 0; i < ng; ++i) {
+            if (test_bit(i, dead)) {
+                s->temps[i].state = TS_DEAD;
+                la_reset_pref(&s->temps[i]);
+            }
+        }
+    }
+}
+
 /*
  * liveness analysis: conditional branch: all temps are dead unless
  * explicitly live-across-conditional-branch, globals and local temps
- * should be synced.
+ * should be synced, except for globals that are DEAD at the destination.
  */
-static void la_bb_sync(TCGContext *s, int ng, int nt)
+static void la_bb_sync(TCGContext *s, int ng, int nt,
+                       const unsigned long *dead)
 {
-    la_global_sync(s, ng);
+    for (int i = 0; i < ng; ++i) {
+        int state = s->temps[i].state;
+
+        if (dead && test_bit(i, dead)) {
+            continue;
+        }
+        s->temps[i].state = state | TS_MEM;
+        if (state == TS_DEAD) {
+            /* If the global was previously dead, reset prefs.  */
+            la_reset_pref(&s->temps[i]);
+        }
+    }
 
     for (int i = ng; i < nt; ++i) {
         TCGTemp *ts = &s->temps[i];
@@ -3798,6 +3851,22 @@ liveness_pass_0(TCGContext *s)
     }
 }
 
+/* The label that is the destination of a branch opcode.  */
+static TCGLabel *branch_label(TCGOp *op)
+{
+    switch (op->opc) {
+    case INDEX_op_br:
+        return arg_label(op->args[0]);
+    case INDEX_op_brcond_i32:
+    case INDEX_op_brcond_i64:
+        return arg_label(op->args[3]);
+    case INDEX_op_brcond2_i32:
+        return arg_label(op->args[5]);
+    default:
+        g_assert_not_reached();
+    }
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -3808,6 +3877,7 @@ liveness_pass_1(TCGContext *s)
     int nb_temps = s->nb_temps;
     TCGOp *op, *op_prev;
     TCGRegSet *prefs;
+    unsigned long **label_dead;
     int i;
 
     prefs = tcg_malloc(sizeof(TCGRegSet) * nb_temps);
@@ -3815,6 +3885,14 @@ liveness_pass_1(TCGContext *s)
         s->temps[i].state_ptr = prefs + i;
     }
 
+    /*
+     * Globals dead at each label, indexed by label id.  Labels are
+     * visited before the forward branches that target them; a label
+     * that has not been visited has all globals live.
+     */
+    label_dead = tcg_malloc(sizeof(*label_dead) * s->nb_labels);
+    memset(label_dead, 0, sizeof(*label_dead) * s->nb_labels);
+
     /* ??? Should be redundant with the exit_tb that ends the TB.  */
     la_func_end(s, nb_globals, nb_temps);
 
@@ -4073,9 +4151,19 @@ liveness_pass_1(TCGContext *s)
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
-                la_bb_sync(s, nb_globals, nb_temps);
+                la_bb_sync(s, nb_globals, nb_temps,
+                           label_dead[branch_label(op)->id]);
             } else if (def->flags & TCG_OPF_BB_END) {
+                unsigned long *dead;
+
+                if (opc == INDEX_op_set_label) {
+                    dead = la_label_dead_globals(s, nb_globals);
+                    label_dead[arg_label(op->args[0])->id] = dead;
+                } else {
+                    dead = label_dead[branch_label(op)->id];
+                }
                 la_bb_end(s, nb_globals, nb_temps);
+                la_label_kill(s, nb_globals, dead);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                 la_global_sync(s, nb_globals);
                 if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -4755,12 +4843,12 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
 /*
  * At a conditional branch, we assume all temporaries are dead unless
  * explicitly live-across-conditional-branch; all globals and local
- * temps are synced to their location.
+ * temps are synced to their location.  The exception is globals that
+ * are dead at the branch destination: those may stay in registers
+ * without being synced, so there is no sync_globals check here.
  */
 static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
 {
-    sync_globals(s, allocated_regs);
-
     for (int i = s->nb_globals; i < s->nb_temps; i++) {
         TCGTemp *ts = &s->temps[i];
         /*
@@ -0,0 +1,228 @@
+/*
+ * fp-test-vec.c - test QEMU's batched softfloat operations
+ *
+ * Every lane of float{32,64}_{add,sub,mul}_vec must produce the same
+ * result as the scalar operation, and the accumulated exception flags
+ * must match, whatever mix of special and ordinary lanes is given.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "qemu/osdep.h"
+#include "fpu/softfloat.h"
+
+/* More than two chunks, with a partial one at the end */
+#define N_LANES 37
+
+typedef void vec_fn32(size_t, float32 *, const float32 *, const float32 *,
+                      float_status *);
+typedef float32 scalar_fn32(float32, float32, float_status *);
+typedef void vec_fn64(size_t, float64 *, const float64 *, const float64 *,
+                      float_status *);
+typedef float64 scalar_fn64(float64, float64, float_status *);
+
+static const FloatRoundMode rounding_modes[] = {
+    float_round_nearest_even,
+    float_round_down,
+    float_round_up,
+    float_round_to_zero,
+    float_round_ties_away,
+};
+
+static const uint32_t special32[] = {
+    0x00000000, 0x80000000,             /* zeros */
+    0x7f800000, 0xff800000,             /* infinities */
+    0x7fc00000, 0xffc12345,             /* quiet NaNs */
+    0x7fa00000, 0xff812345,             /* signaling NaNs */
+    0x00000001, 0x807fffff, 0x00400000, /* denormals */
+    0x00800000, 0x80800001,             /* smallest normals */
+    0x7f7fffff, 0xff7ffffe,             /* largest normals */
+};
+
+static const uint64_t special64[] = {
+    0x0000000000000000ull, 0x8000000000000000ull,
+    0x7ff0000000000000ull, 0xfff0000000000000ull,
+    0x7ff8000000000000ull, 0xfff8000000012345ull,
+    0x7ff4000000000000ull, 0xfff0000000012345ull,
+    0x0000000000000001ull, 0x800fffffffffffffull, 0x0008000000000000ull,
+    0x0010000000000000ull, 0x8010000000000001ull,
+    0x7fefffffffffffffull, 0xffeffffffffffffeull,
+};
+
+static int errors;
+
+static void init_status(float_status *s, FloatRoundMode rm, bool ftz,
+                        bool inexact)
+{
+    memset(s, 0, sizeof(*s));
+    set_float_2nan_prop_rule(float_2nan_prop_s_ab, s);
+    set_float_default_nan_pattern(0b01000000, s);
+    set_float_rounding_mode(rm, s);
+    set_flush_to_zero(ftz, s);
+    set_flush_inputs_to_zero(ftz, s);
+    /* With inexact already set, the host FPU may be used */
+    set_float_exception_flags(inexact ? float_flag_inexact : 0, s);
+}
+
+static void report(const char *name, const float_status *s, int lane,
+                   uint64_t a, uint64_t b, uint64_t vec, uint64_t ref)
+{
+    printf("%s, rounding %d, ftz %d: lane %d: %#" PRIx64 " op %#" PRIx64
+           ": vec %#" PRIx64 ", scalar %#" PRIx64 "\n",
+           name, get_float_rounding_mode(s), get_flush_to_zero(s), lane,
+           a, b, vec, ref);
+    if (++errors == 20) {
+        exit(1);
+    }
+}
+
+#define DEFINE_CHECK(N)                                                     \
+static void check##N(const char *name, vec_fn##N *vec,                      \
+                     scalar_fn##N *scalar, const float##N *a,               \
+                     const float##N *b, const float_status *init)           \
+{                                                                           \
+    float##N d[N_LANES], ref[N_LANES];                                      \
+    float_status s_vec = *init, s_ref = *init;                              \
+    int i;                                                                  \
+                                                                            \
+    for (i = 0; i < N_LANES; i++) {                                         \
+        ref[i] = scalar(a[i], b[i], &s_ref);                                \
+    }                                                                       \
+    vec(N_LANES, d, a, b, &s_vec);                                          \
+    for (i = 0; i < N_LANES; i++) {                                         \
+        if (d[i] != ref[i]) {                                               \
+            report(name, init, i, a[i], b[i], d[i], ref[i]);                \
+        }                                                                   \
+    }                                                                       \
+    if (get_float_exception_flags(&s_vec) !=                                \
+        get_float_exception_flags(&s_ref)) {                                \
+        printf("%s, rounding %d, ftz %d: flags %#x, scalar %#x\n", name,    \
+               get_float_rounding_mode(init), get_flush_to_zero(init),      \
+               get_float_exception_flags(&s_vec),                           \
+               get_float_exception_flags(&s_ref));                          \
+        if (++errors == 20) {                                               \
+            exit(1);                                                        \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    /* The destination may alias the first input */                         \
+    s_vec = *init;                                                          \
+    memcpy(d, a, sizeof(d));                                                \
+    vec(N_LANES, d, d, b, &s_vec);                                          \
+    for (i = 0; i < N_LANES; i++) {                                         \
+        if (d[i] != ref[i]) {                                               \
+            report(name, init, i, a[i], b[i], d[i], ref[i]);                \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static void test##N(const char *name, vec_fn##N *vec,                       \
+                    scalar_fn##N *scalar, const float_status *s,            \
+                    const float##N *a_base, const float##N *b_base)         \
+{                                                                           \
+    static const int pos[] = { 0, 15, 16, N_LANES - 1 };                    \
+    float##N a[N_LANES], b[N_LANES];                                        \
+    size_t i, j;                                                            \
+                                                                            \
+    memcpy(a, a_base, sizeof(a));                                           \
+    memcpy(b, b_base, sizeof(b));                                           \
+    check##N(name, vec, scalar, a, b, s);                                   \
+                                                                            \
+    /* One special lane among ordinary ones, in either operand */           \
+    for (i = 0; i < ARRAY_SIZE(special##N); i++) {                          \
+        for (j = 0; j < ARRAY_SIZE(pos); j++) {                             \
+            a[pos[j]] = special##N[i];                                      \
+            check##N(name, vec, scalar, a, b, s);                           \
+            a[pos[j]] = a_base[pos[j]];                                     \
+            b[pos[j]] = special##N[i];                                      \
+            check##N(name, vec, scalar, a, b, s);                           \
+            b[pos[j]] = b_base[pos[j]];                                     \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    /* Every pair of special values */                                      \
+    for (i = 0; i < N_LANES; i++) {                                         \
+        a[i] = special##N[i % ARRAY_SIZE(special##N)];                      \
+    }                                                                       \
+    for (j = 0; j < ARRAY_SIZE(special##N); j++) {                          \
+        for (i = 0; i < N_LANES; i++) {                                     \
+            b[i] = special##N[(i + j) % ARRAY_SIZE(special##N)];            \
+        }                                                                   \
+        check##N(name, vec, scalar, a, b, s);                               \
+    }                                                                       \
+}
+
+DEFINE_CHECK(32)
+DEFINE_CHECK(64)
+
+int main(int ac, char **av)
+{
+    float32 a32[N_LANES], b32[N_LANES], tiny32[N_LANES], huge32[N_LANES];
+    float64 a64[N_LANES], b64[N_LANES], tiny64[N_LANES], huge64[N_LANES];
+    size_t i, r;
+    int ftz, inexact;
+
+    for (i = 0; i < N_LANES; i++) {
+        union { float f; float32 i; } f;
+        union { double d; float64 i; } d;
+
+        f.f = (drand48() - 0.5) * 2000;
+        a32[i] = f.i;
+        f.f = (drand48() - 0.5) * 2000;
+        b32[i] = f.i;
+        d.d = (drand48() - 0.5) * 2000;
+        a64[i] = d.i;
+        d.d = (drand48() - 0.5) * 2000;
+        b64[i] = d.i;
+
+        /* Results that are tiny or overflow, but inputs that are not */
+        tiny32[i] = 0x00800000 + i;
+        tiny64[i] = 0x0010000000000000ull + i;
+        huge32[i] = 0x7f000000 + i;
+        huge64[i] = 0x7fe0000000000000ull + i;
+    }
+
+    for (r = 0; r < ARRAY_SIZE(rounding_modes); r++) {
+        for (ftz = 0; ftz < 2; ftz++) {
+            for (inexact = 0; inexact < 2; inexact++) {
+                float_status s;
+
+                init_status(&s, rounding_modes[r], ftz, inexact);
+
+                test32("f32_add", float32_add_vec, float32_add, &s, a32, b32);
+                test32("f32_sub", float32_sub_vec, float32_sub, &s, a32, b32);
+                test32("f32_mul", float32_mul_vec, float32_mul, &s, a32, b32);
+                test32("f32_sub", float32_sub_vec, float32_sub, &s,
+                       tiny32, a32);
+                test32("f32_sub", float32_sub_vec, float32_sub, &s,
+                       tiny32, tiny32);
+                test32("f32_mul", float32_mul_vec, float32_mul, &s,
+                       tiny32, tiny32);
+                test32("f32_add", float32_add_vec, float32_add, &s,
+                       huge32, huge32);
+                test32("f32_mul", float32_mul_vec, float32_mul, &s,
+                       huge32, a32);
+
+                test64("f64_add", float64_add_vec, float64_add, &s, a64, b64);
+                test64("f64_sub", float64_sub_vec, float64_sub, &s, a64, b64);
+                test64("f64_mul", float64_mul_vec, float64_mul, &s, a64, b64);
+                test64("f64_sub", float64_sub_vec, float64_sub, &s,
+                       tiny64, a64);
+                test64("f64_sub", float64_sub_vec, float64_sub, &s,
+                       tiny64, tiny64);
+                test64("f64_mul", float64_mul_vec, float64_mul, &s,
+                       tiny64, tiny64);
+                test64("f64_add", float64_add_vec, float64_add, &s,
+                       huge64, huge64);
+                test64("f64_mul", float64_mul_vec, float64_mul, &s,
+                       huge64, a64);
+            }
+        }
+    }
+
+    return errors != 0;
+}
@@ -28,6 +28,14 @@ typedef struct {
 
 static const uint64_t cond_trigger_limit = 100;
 
+#define MEM_RING_SIZE 64
+
+typedef struct {
+    uint64_t count;
+    uint64_t addr[MEM_RING_SIZE];
+    uint64_t drained;
+} CPURing;
+
 typedef struct {
     uint64_t data_insn;
     uint64_t data_tb;
@@ -49,6 +57,9 @@ static struct qemu_plugin_scoreboard *data;
 static qemu_plugin_u64 data_insn;
 static qemu_plugin_u64 data_tb;
 static qemu_plugin_u64 data_mem;
+static struct qemu_plugin_scoreboard *rings;
+static qemu_plugin_u64 ring;
+static qemu_plugin_u64 ring_drained;
 
 static uint64_t global_count_tb;
 static uint64_t global_count_insn;
@@ -111,14 +122,18 @@ static void stats_mem(void)
     const uint64_t per_vcpu = qemu_plugin_u64_sum(count_mem);
     const uint64_t inl_per_vcpu =
         qemu_plugin_u64_sum(count_mem_inline);
+    const uint64_t recorded =
+        qemu_plugin_u64_sum(ring_drained) + qemu_plugin_u64_sum(ring);
     g_autoptr(GString) stats = g_string_new("");
     g_string_append_printf(stats, "mem: %" PRIu64 "\n", expected);
     g_string_append_printf(stats, "mem: %" PRIu64 " (per vcpu)\n", per_vcpu);
     g_string_append_printf(stats, "mem: %" PRIu64 " (per vcpu inline)\n", inl_per_vcpu);
+    g_string_append_printf(stats, "mem: %" PRIu64 " (ring)\n", recorded);
     qemu_plugin_outs(stats->str);
     g_assert(expected > 0);
     g_assert(per_vcpu == expected);
     g_assert(inl_per_vcpu == expected);
+    g_assert(recorded == expected);
 }
 
 static void plugin_exit(qemu_plugin_id_t id, void *udata)
@@ -172,6 +187,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
 
     qemu_plugin_scoreboard_free(counts);
     qemu_plugin_scoreboard_free(data);
+    qemu_plugin_scoreboard_free(rings);
 }
 
 static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
@@ -223,6 +239,14 @@ static void vcpu_mem_access(unsigned int cpu_index,
     g_mutex_unlock(&mem_lock);
 }
 
+static void vcpu_mem_ring_drain(unsigned int cpu_index, void *udata)
+{
+    uint64_t n = qemu_plugin_u64_get(ring, cpu_index);
+
+    g_assert(n > 0 && n <= MEM_RING_SIZE);
+    qemu_plugin_u64_add(ring_drained, cpu_index, n);
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     void *tb_store = tb;
@@ -270,6 +294,9 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
             insn, QEMU_PLUGIN_MEM_RW,
             QEMU_PLUGIN_INLINE_ADD_U64,
             count_mem_inline, 1);
+        qemu_plugin_register_vcpu_mem_ring_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, ring, MEM_RING_SIZE,
+            vcpu_mem_ring_drain, QEMU_PLUGIN_CB_NO_REGS, NULL);
     }
 }
 
@@ -302,6 +329,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     data_insn = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_insn);
     data_tb = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_tb);
     data_mem = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_mem);
+    rings = qemu_plugin_scoreboard_new(sizeof(CPURing));
+    ring = qemu_plugin_scoreboard_u64_in_struct(rings, CPURing, count);
+    ring_drained = qemu_plugin_scoreboard_u64_in_struct(rings, CPURing,
+                                                        drained);
 
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
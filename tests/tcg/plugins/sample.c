@@ -0,0 +1,64 @@
+/*
+ * Test the timer-driven vcpu sampling callback.
+ *
+ * Samples are taken until SAMPLE_LIMIT have been seen, then the plugin
+ * resets itself, which stops the sampler, and registers the callback
+ * again, which starts it anew.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+#define SAMPLE_PERIOD_NS 1000000
+#define SAMPLE_LIMIT 16
+
+static qemu_plugin_id_t plugin_id;
+static gint reset_requested;
+static gint samples[2];
+
+static void vcpu_sample(qemu_plugin_id_t id, unsigned int vcpu_index,
+                        uint64_t pc);
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autofree gchar *out =
+        g_strdup_printf("samples: %d before reset, %d after reset\n",
+                        g_atomic_int_get(&samples[0]),
+                        g_atomic_int_get(&samples[1]));
+
+    qemu_plugin_outs(out);
+}
+
+static void after_reset(qemu_plugin_id_t id)
+{
+    qemu_plugin_outs("reset done\n");
+    qemu_plugin_register_vcpu_sample_cb(id, 2 * SAMPLE_PERIOD_NS,
+                                        vcpu_sample);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+}
+
+static void vcpu_sample(qemu_plugin_id_t id, unsigned int vcpu_index,
+                        uint64_t pc)
+{
+    int phase = g_atomic_int_get(&reset_requested);
+
+    g_assert(vcpu_index < qemu_plugin_num_vcpus());
+    if (g_atomic_int_add(&samples[phase], 1) + 1 == SAMPLE_LIMIT &&
+        g_atomic_int_compare_and_exchange(&reset_requested, 0, 1)) {
+        qemu_plugin_reset(plugin_id, after_reset);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    plugin_id = id;
+    qemu_plugin_register_vcpu_sample_cb(id, SAMPLE_PERIOD_NS, vcpu_sample);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}